@@ -1,3 +1,8 @@
+// std::min/std::max zamiast makr min/max z windows.h
+#define NOMINMAX
+// Przed naglowkami SFML: na Windows dolacza winsock2.h, zanim SFML dolaczy windows.h.
+#include "SharedState.h"
+
 #include <SFML/Window.hpp>
 #include <SFML/Graphics.hpp>
 #include <SFML/OpenGL.hpp>
@@ -6,11 +11,42 @@
 #include <GL/glu.h>
 #pragma comment(lib, "opengl32.lib")
 #pragma comment(lib, "glu32.lib")
+// bez laczenia mnozenia z dodawaniem w FMA, zeby hasze z golden_traces.txt nie zalezaly od /arch
+// (GCC i Clang: -ffp-contract=off, patrz README)
+#ifdef _MSC_VER
+#pragma fp_contract(off)
+#endif
 
 #include <iostream>
 #include <cmath>
 #include <vector>
 #include <cstdlib>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <queue>
+#include <functional>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+#include <unordered_map>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 GLuint g_grassTexture = 0;
@@ -48,11 +84,17 @@ bool loadGrassTexture(const std::string& path)
     return true;
 }
 
+// Wysokosc mrowki nie jest przechowywana: zawsze wynosi antHeightAt(x, z). Indeksy sa 16-bitowe
+// (komorek gestosci jest 400, slotow usypiania najwyzej MAX_ANTS), wiec cala mrowka ma 24 bajty.
 struct Ant {
-    float x, y, z;
+    float x, z;
     float dirX, dirZ;
 
     bool carryingFood = false;
+
+    std::int16_t densityCell = -1;
+
+    std::int16_t lazySlot = -1;
 };
 
 
@@ -61,8 +103,6 @@ struct Food {
     int amount;
 };
 
-std::vector<Food> foods;
-
 const std::size_t MAX_FOOD_SOURCES = 20;
 
 struct Obstacle {
@@ -70,21 +110,436 @@ struct Obstacle {
     float size;
 };
 
-std::vector<Ant> ants;
-std::vector<Obstacle> obstacles;
-
 
 const float ANTHILL_BASE_RADIUS = 10.0f;
 const float ANTHILL_TOP_RADIUS = 3.0f;
 const float ANTHILL_HEIGHT = 12.0f;
 const float ANTHILL_HOLE_RADIUS = 1.0f;
 const int MAX_ANTS = 2000;
+static_assert(MAX_ANTS <= 32767, "Ant::lazySlot is 16-bit");
+
+const float WORLD_HALF_SIZE = 50.0f;
+const float BOUNCE_MARGIN = 1.0f;
+
+const float AVOID_RADIUS = 2.0f;
+const float AVOID_RADIUS2 = AVOID_RADIUS * AVOID_RADIUS;
+
+const float OBSTACLE_MARGIN = 1.5f;
+const float OBSTACLE_WEIGHT = 8.0f;
+
+const float FOOD_PICK_RADIUS = 1.5f;
+const float NEST_RADIUS = ANTHILL_TOP_RADIUS + 1.0f;
+
+// ----------------- TRYGONOMETRIA SYMULACJI -----------------
+
+// sin/cos/atan2 z bibliotek standardowych MSVC i glibc roznia sie na ostatnim bicie, a po kilkuset
+// tickach to juz inna symulacja. Symulacja liczy je wiec sama, tylko dodawaniem, mnozeniem, dzieleniem
+// i sqrt w double, ktore daja ten sam wynik na kazdym kompilatorze (hasze z --golden-check sa przenosne).
+const double SIM_PI_2_HI = 1.5707963267341256;   // pi/2 rozbite na dwie czesci, zeby redukcja
+const double SIM_PI_2_LO = 6.077100506506192e-11; // kata nie tracila dokladnosci
+const double SIM_PI = 3.141592653589793;
+
+// sin i cos dla |r| <= pi/4 (szereg Taylora, blad ponizej 1e-13)
+void sinCosReduced(double r, double& s, double& c)
+{
+    double r2 = r * r;
+    s = r * (1.0 + r2 * (-1.0 / 6 + r2 * (1.0 / 120 + r2 * (-1.0 / 5040 + r2 * (1.0 / 362880
+        + r2 * (-1.0 / 39916800 + r2 * (1.0 / 6227020800.0)))))));
+    c = 1.0 + r2 * (-1.0 / 2 + r2 * (1.0 / 24 + r2 * (-1.0 / 720 + r2 * (1.0 / 40320
+        + r2 * (-1.0 / 3628800 + r2 * (1.0 / 479001600 + r2 * (-1.0 / 87178291200.0)))))));
+}
+
+void simSinCos(float angle, float& sinOut, float& cosOut)
+{
+    double x = angle;
+    double q = std::floor(x / SIM_PI_2_HI + 0.5);
+    double r = (x - q * SIM_PI_2_HI) - q * SIM_PI_2_LO;
+
+    double s, c;
+    sinCosReduced(r, s, c);
+
+    switch (static_cast<long long>(q) & 3) {
+    case 0: sinOut = static_cast<float>(s);  cosOut = static_cast<float>(c);  break;
+    case 1: sinOut = static_cast<float>(c);  cosOut = static_cast<float>(-s); break;
+    case 2: sinOut = static_cast<float>(-s); cosOut = static_cast<float>(-c); break;
+    default: sinOut = static_cast<float>(-c); cosOut = static_cast<float>(s); break;
+    }
+}
+
+float simSin(float angle)
+{
+    float s, c;
+    simSinCos(angle, s, c);
+    return s;
+}
+
+float simCos(float angle)
+{
+    float s, c;
+    simSinCos(angle, s, c);
+    return c;
+}
+
+float simAtan2(float y, float x)
+{
+    double ax = std::fabs(static_cast<double>(x));
+    double ay = std::fabs(static_cast<double>(y));
+    if (ax == 0.0 && ay == 0.0)
+        return 0.0f;
+
+    // atan(t) dla t w [0, 1]; dwa razy atan(t) = 2 atan(t / (1 + sqrt(1 + t^2))), potem szereg
+    bool swapped = ay > ax;
+    double t = swapped ? ax / ay : ay / ax;
+    t = t / (1.0 + std::sqrt(1.0 + t * t));
+    t = t / (1.0 + std::sqrt(1.0 + t * t));
+    double t2 = t * t;
+    double a = 4.0 * t * (1.0 + t2 * (-1.0 / 3 + t2 * (1.0 / 5 + t2 * (-1.0 / 7 + t2 * (1.0 / 9
+        + t2 * (-1.0 / 11 + t2 * (1.0 / 13 + t2 * (-1.0 / 15))))))));
+
+    if (swapped) a = SIM_PI / 2 - a;
+    if (x < 0.0f) a = SIM_PI - a;
+    if (y < 0.0f) a = -a;
+    return static_cast<float>(a);
+}
+
+// ----------------- ZWARTA REPREZENTACJA MROWKI -----------------
+
+// 12 bajtow zamiast 24: pozycja w stalym przecinku 16.16 wzgledem srodka swiata,
+// kierunek jako kat skwantowany do 16 bitow, stan w bitach. Wysokosc liczona na zadanie.
+const float FIXED_ONE = 65536.0f;
+const float HEADING_STEPS = 65536.0f;
+const std::uint16_t PACKED_CARRYING = 1;
 
-const float ANT_SPEED = 3.0f;
+struct PackedAnt {
+    std::int32_t x, z;
+    std::uint16_t heading;
+    std::uint16_t flags;
+};
+
+static_assert(sizeof(PackedAnt) == 12, "PackedAnt should stay 12 bytes");
+
+std::int32_t floatToFixed(float v)
+{
+    return static_cast<std::int32_t>(std::lround(v * FIXED_ONE));
+}
+
+float fixedToFloat(std::int32_t v)
+{
+    return v / FIXED_ONE;
+}
+
+PackedAnt packAnt(const Ant& a)
+{
+    const float TWO_PI = 2.0f * 3.14159265f;
+
+    float angle = simAtan2(a.dirZ, a.dirX);
+    if (angle < 0.0f) angle += TWO_PI;
+
+    PackedAnt p;
+    p.x = floatToFixed(a.x);
+    p.z = floatToFixed(a.z);
+    p.heading = static_cast<std::uint16_t>(std::lround(angle / TWO_PI * HEADING_STEPS) & 0xffff);
+    p.flags = a.carryingFood ? PACKED_CARRYING : 0;
+    return p;
+}
 
 const std::size_t MAX_OBSTACLES = 35;
 
 
+// ----------------- METRYKI -----------------
+
+// Liczniki sa per-watek (kazdy watek pisze tylko do swojego slotu w osobnej linii cache),
+// a czytelnik sumuje sloty bez blokad.
+const int MAX_STAT_THREADS = 16;
+
+struct alignas(64) TickCounters {
+    std::atomic<std::uint64_t> pickups{ 0 };
+    std::atomic<std::uint64_t> deliveries{ 0 };
+    std::atomic<std::uint64_t> lostLoads{ 0 };
+};
+
+struct CounterTotals {
+    std::uint64_t pickups = 0;
+    std::uint64_t deliveries = 0;
+    std::uint64_t lostLoads = 0;
+};
+
+// Zgrubny histogram gestosci mrowek, aktualizowany tylko gdy mrowka zmienia komorke.
+const int DENSITY_GRID = 20;
+const float DENSITY_HALF_SIZE = 50.0f;
+const float DENSITY_CELL_SIZE = 2.0f * DENSITY_HALF_SIZE / DENSITY_GRID;
+static_assert(DENSITY_GRID * DENSITY_GRID <= 32767, "Ant::densityCell is 16-bit");
+// podzial komorki przy rysowaniu mapy gestosci na terenie
+const int DENSITY_OVERLAY_STEPS = 4;
+
+bool g_showDensity = false;
+
+// ----------------- LENIWE AKTUALIZACJE -----------------
+
+// Mrowka wracajaca z jedzeniem, bez sasiadow i przeszkod na drodze, idzie po prostej do gniazda.
+// Usypiamy ja na tyle tickow, ile na pewno nie zblizy sie do niej zadna inna mrowka (kazda przechodzi
+// najwyzej antSpeed * dt na tick) i nie dojdzie do gniazda. Przez ten czas nikt jej nie szuka ani ona
+// nikogo, bo odpychanie i tak byloby zerowe. Przy wybudzeniu jej kroki sa powtarzane tymi samymi
+// funkcjami co w updateAnts, wiec stan zgadza sie bit w bit z symulacja bez usypiania.
+struct LazyPath {
+    std::size_t antIndex;
+    std::uint64_t startTick;  // (x, z) mrowki sa aktualne na poczatku tego ticku
+    std::uint64_t wakeTick;
+    float dirX, dirZ;         // kierunek do gniazda, tylko do przyblizonej pozycji
+    unsigned generation = 0;
+};
+
+struct LazyEvent {
+    std::uint64_t tick;
+    int slot;
+    unsigned generation;
+
+    bool operator>(const LazyEvent& other) const { return tick > other.tick; }
+};
+
+// ----------------- POLE KIERUNKOW DO GNIAZDA -----------------
+
+// Siatka nad calym swiatem: koszt dojscia do gniazda po wolnych komorkach (Dijkstra, 8 sasiadow)
+// i nastepna komorka na najkrotszej drodze. Mrowka niosaca jedzenie, ktorej prosta droga do gniazda
+// jest zaslonieta przeszkoda, bierze kierunek z komorki w O(1). Przy dodaniu/usunieciu przeszkody
+// przeliczany jest tylko obszar, ktorego koszty faktycznie sie zmieniaja.
+const int FLOW_GRID = 100;
+const float FLOW_CELL_SIZE = 2.0f * WORLD_HALF_SIZE / FLOW_GRID;
+const float FLOW_UNREACHABLE = 1e30f;
+const int FLOW_LOOKAHEAD = 8;
+
+struct FlowField {
+    bool built = false;
+
+    std::vector<float> cost;
+    std::vector<int> next;
+    std::vector<std::uint16_t> blockers;
+    // ile przeszkod zaslania prosty odcinek od srodka komorki do gniazda
+    std::vector<std::uint16_t> shadows;
+    // komorka drogi, w ktora celuje mrowka z zacienionej komorki (-1 poza cieniem), liczona przy naprawie
+    std::vector<int> aim;
+    // komorki ze zmieniona droga lub blokada (cel zmienia sie w ich otoczeniu) i komorki, ktore weszly
+    // w cien albo z niego wyszly (zmienia sie tylko ich wlasny cel)
+    std::vector<int> aimSources;
+    std::vector<int> aimCells;
+
+    std::vector<int> dirty;
+    std::vector<int> newlyBlocked;
+
+    std::size_t lastRepairCells = 0;
+};
+
+// ----------------- KOLEJKA POLECEN -----------------
+
+// Zmiany swiata (dodawanie/usuwanie mrowek, jedzenia, przeszkod) nie sa robione w miejscu, tylko
+// zlecane przez submitCommand z dowolnego watku (okno, kanal sterujacy) i stosowane przez symulacje
+// na poczatku ticku. Kolejka to pierscien o stalym rozmiarze z numerem sekwencji w kazdej komorce:
+// nadawcy rezerwuja komorke przez compare_exchange na tail, jedyny odbiorca czyta od head bez atomikow
+// na indeksie. Nikt nie czeka na blokadzie; pelna kolejka odrzuca polecenie.
+enum class WorldCommandType {
+    SpawnAnts,
+    KillAnts,
+    KillAllAnts,
+    AddFood,
+    AddObstacle,
+    RemoveObstacle,
+};
+
+struct WorldCommand {
+    WorldCommandType type;
+    int count;
+};
+
+const std::size_t COMMAND_QUEUE_SIZE = 1024;
+static_assert((COMMAND_QUEUE_SIZE & (COMMAND_QUEUE_SIZE - 1)) == 0, "command queue size must be a power of two");
+
+struct CommandCell {
+    std::atomic<std::size_t> sequence;
+    WorldCommand command;
+};
+
+struct CommandQueue {
+    CommandCell cells[COMMAND_QUEUE_SIZE];
+    alignas(64) std::atomic<std::size_t> tail{ 0 };
+    alignas(64) std::size_t head = 0;
+
+    CommandQueue()
+    {
+        for (std::size_t i = 0; i < COMMAND_QUEUE_SIZE; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+};
+
+bool submitCommand(CommandQueue& q, WorldCommandType type, int count = 1)
+{
+    std::size_t pos = q.tail.load(std::memory_order_relaxed);
+    for (;;) {
+        CommandCell& cell = q.cells[pos & (COMMAND_QUEUE_SIZE - 1)];
+        std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+
+        if (diff == 0) {
+            if (q.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.command = { type, count };
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = q.tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Tylko z watku symulacji.
+bool popCommand(CommandQueue& q, WorldCommand& out)
+{
+    CommandCell& cell = q.cells[q.head & (COMMAND_QUEUE_SIZE - 1)];
+    if (cell.sequence.load(std::memory_order_acquire) != q.head + 1)
+        return false;
+
+    out = cell.command;
+    cell.sequence.store(q.head + COMMAND_QUEUE_SIZE, std::memory_order_release);
+    q.head++;
+    return true;
+}
+
+// ----------------- SWIAT SYMULACJI -----------------
+
+// Stale dostrajane recznie; teraz mozna je zmieniac w trakcie dzialania i przemiatac w trybie --batch.
+struct SimParams {
+    float antSpeed = 3.0f;
+    float turnSpeed = 4.0f;
+    float reorientProbPerSec = 0.5f;
+    float foodDetectRadius = 8.0f;
+    float avoidWeight = 5.0f;
+};
+
+// Caly zmienny stan jednej symulacji. Okno uzywa g_world, tryb wsadowy tworzy osobny swiat
+// na kazdy przebieg, wiec rownolegle symulacje nie wspoldziela zadnego zmiennego stanu.
+struct World {
+    std::vector<Ant> ants;
+    std::vector<Food> foods;
+    std::vector<Obstacle> obstacles;
+
+    SimParams params;
+    std::mt19937 rng;
+
+    TickCounters counters[MAX_STAT_THREADS];
+    int density[DENSITY_GRID * DENSITY_GRID] = {};
+
+    // wylaczone domyslnie; przelacza klawisz L
+    bool lazyUpdates = false;
+    double simTime = 0.0;
+    std::uint64_t tick = 0;
+
+    // wylaczone domyslnie (omijanie przeszkod wydluza powroty i nie zwieksza dostaw); przelacza klawisz G
+    bool useFlowField = false;
+    FlowField flow;
+
+    CommandQueue commands;
+
+    std::vector<LazyPath> lazyPaths;
+    std::vector<int> freeLazySlots;
+    std::priority_queue<LazyEvent, std::vector<LazyEvent>, std::greater<LazyEvent>> lazyEvents;
+    std::size_t lazyCount = 0;
+    // krok, z jakim spia uspione mrowki; tick z innym krokiem najpierw budzi wszystkie
+    float lazyDt = 0.0f;
+    // pozycje uspionych mrowek w biezacym ticku (cacheSleeperPositions + nowo uspione)
+    std::vector<float> sleeperX, sleeperZ;
+
+    // Zamiast ants: zwarta tablica dla duzych kolonii (tryb --packed).
+    bool packedAnts = false;
+    std::vector<PackedAnt> packed;
+};
+
+World g_world;
+
+unsigned worldRand(World& world)
+{
+    return static_cast<unsigned>(world.rng() & 0x7fffffff);
+}
+
+TickCounters& localCounters(World& world)
+{
+    static std::atomic<int> nextSlot{ 0 };
+    thread_local int slot = nextSlot.fetch_add(1, std::memory_order_relaxed) % MAX_STAT_THREADS;
+    return world.counters[slot];
+}
+
+CounterTotals sumCounters(const World& world)
+{
+    CounterTotals t;
+    for (const auto& c : world.counters) {
+        t.pickups += c.pickups.load(std::memory_order_relaxed);
+        t.deliveries += c.deliveries.load(std::memory_order_relaxed);
+        t.lostLoads += c.lostLoads.load(std::memory_order_relaxed);
+    }
+    return t;
+}
+
+int densityCellAt(float x, float z)
+{
+    int cx = static_cast<int>((x + DENSITY_HALF_SIZE) / DENSITY_CELL_SIZE);
+    int cz = static_cast<int>((z + DENSITY_HALF_SIZE) / DENSITY_CELL_SIZE);
+    if (cx < 0) cx = 0;
+    if (cx >= DENSITY_GRID) cx = DENSITY_GRID - 1;
+    if (cz < 0) cz = 0;
+    if (cz >= DENSITY_GRID) cz = DENSITY_GRID - 1;
+    return cz * DENSITY_GRID + cx;
+}
+
+void densityTrack(World& world, Ant& a)
+{
+    int cell = densityCellAt(a.x, a.z);
+    if (cell == a.densityCell) return;
+
+    if (a.densityCell >= 0)
+        world.density[a.densityCell]--;
+    world.density[cell]++;
+    a.densityCell = static_cast<std::int16_t>(cell);
+}
+
+void densityForget(World& world, const Ant& a)
+{
+    if (a.densityCell >= 0)
+        world.density[a.densityCell]--;
+}
+
+Ant unpackAnt(const PackedAnt& p)
+{
+    const float TWO_PI = 2.0f * 3.14159265f;
+    float angle = p.heading / HEADING_STEPS * TWO_PI;
+
+    Ant a;
+    a.x = fixedToFloat(p.x);
+    a.z = fixedToFloat(p.z);
+    a.dirX = simCos(angle);
+    a.dirZ = simSin(angle);
+    a.carryingFood = (p.flags & PACKED_CARRYING) != 0;
+    a.densityCell = static_cast<std::int16_t>(densityCellAt(a.x, a.z));
+    return a;
+}
+
+void wakeAllLazyAnts(World& world);
+std::size_t applyWorldCommands(World& world);
+
+const float METRICS_PERIOD = 1.0f;
+
+struct MetricsReporter {
+    std::ofstream out;
+    float sinceReport = 0.0f;
+    double lastSimTime = 0.0;
+    std::uint64_t lastDeliveries = 0;
+    float deliveriesPerSec = 0.0f;
+    // sekundy symulacji na sekunde rzeczywista (przy przyspieszeniu czasu wiecej niz 1)
+    float simSpeed = 0.0f;
+    std::string summary;
+};
+
 float camAngleY = 30.0f;
 float camAngleX = 20.0f;
 float camDist = 25.0f;
@@ -112,13 +567,13 @@ void setupLighting()
     glShadeModel(GL_SMOOTH);
 }
 
-void drawFood()
+void drawFood(const World& world)
 {
     if (!g_quadric) return;
 
     glColor3f(0.9f, 0.9f, 0.1f);
 
-    for (const auto& f : foods) {
+    for (const auto& f : world.foods) {
         glPushMatrix();
         glTranslatef(f.x, f.y, f.z);
         gluSphere(g_quadric, 0.7, 12, 12);
@@ -127,334 +582,3307 @@ void drawFood()
 }
 
 
-void drawGround()
-{
-    float size = 50.0f;
-    float step = 2.0f;
-
-    glNormal3f(0.0f, 1.0f, 0.0f);
+// ----------------- TEREN Z MAPY WYSOKOSCI -----------------
+
+// Plik terenu powstaje z surowej mapy 16-bit (little-endian, wierszami) poleceniem --terrain-convert:
+//   [TerrainHeader, dopelniony do TERRAIN_DATA_OFFSET][kafle 129x129 uint16, wierszami kafli][piramida min/max]
+// Kafel obejmuje 128 komorek, a sasiednie kafle dziela brzegowy wiersz i kolumne probek, wiec interpolacja
+// dwuliniowa nigdy nie siega poza jeden kafel. Kafle sa mapowane do pamieci dopiero przy pierwszym uzyciu
+// (zapytanie o wysokosc pod mrowka albo budowa siatki w zasiegu kamery) i zwalniane wedlug LRU, wiec
+// w pamieci jest najwyzej TERRAIN_MAX_RESIDENT_TILES kafli niezaleznie od rozmiaru mapy. Piramida
+// (min/max kafla i kolejnych poziomow 2x2) jest wczytywana w calosci, bo to ulamek pliku.
+//
+// Teren jest uzywany tylko z watku okna; tryb wsadowy i --verify licza dalej na stozku mrowiska.
+const int TERRAIN_TILE_CELLS = 128;
+const int TERRAIN_TILE_SAMPLES = TERRAIN_TILE_CELLS + 1;
+const std::uint64_t TERRAIN_TILE_BYTES = TERRAIN_TILE_SAMPLES * TERRAIN_TILE_SAMPLES * sizeof(std::uint16_t);
+const std::uint64_t TERRAIN_DATA_OFFSET = 65536;
+const std::uint32_t TERRAIN_MAGIC = 0x54544e41; // "ANTT"
+const std::uint32_t TERRAIN_VERSION = 1;
+
+const std::size_t TERRAIN_MAX_RESIDENT_TILES = 256;
+const std::size_t TERRAIN_MAX_MESHES = 192;
+// siatki dalej niz TERRAIN_VIEW_DISTANCE (albo mniej, patrz Terrain::viewDistance) nie sa rysowane;
+// co kolejne podwojenie TERRAIN_LOD_DISTANCE siatka kafla ma dwa razy rzadsze wierzcholki
+const float TERRAIN_VIEW_DISTANCE = 200.0f;
+const float TERRAIN_LOD_DISTANCE = 40.0f;
+const int TERRAIN_MAX_LOD = 5;
+const float TERRAIN_TEX_SCALE = 0.2f;
+
+struct TerrainHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t tilesX;
+    std::uint32_t tilesZ;
+    std::uint32_t levels;
+    float cellSize;     // jednostki swiata na probke
+    float heightScale;  // jednostki swiata na krok wartosci 16-bit
+    std::uint64_t pyramidOffset;
+};
 
-    float texScale = 0.2f;
+struct TerrainMinMax {
+    std::uint16_t min;
+    std::uint16_t max;
+};
 
-    if (g_grassTexture != 0) {
-        glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, g_grassTexture);
-        glColor3f(1.0f, 1.0f, 1.0f); 
-    }
-    else {
-        glDisable(GL_TEXTURE_2D);
-        glColor3f(0.2f, 0.6f, 0.2f);
-    }
+struct TerrainTileSlot {
+    const std::uint16_t* samples = nullptr;
+    void* view = nullptr;
+    std::size_t viewSize = 0;
+    std::list<int>::iterator lru;
+};
 
-    for (float z = -size; z < size; z += step) {
-        glBegin(GL_TRIANGLE_STRIP);
-        for (float x = -size; x <= size; x += step) {
+struct TerrainMesh {
+    int lod = -1;
+    std::vector<float> vertices;
+    std::vector<float> normals;
+    std::vector<float> texCoords;
+    std::vector<GLuint> indices;
+    std::list<int>::iterator lru;
+};
 
-            float s = (x + size) * texScale;
-            float t1 = (z + size) * texScale;
-            float t2 = (z + step + size) * texScale;
+struct Terrain {
+    bool loaded = false;
+    TerrainHeader header;
+
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+    std::uint64_t granularity = 4096;
+
+    std::vector<TerrainTileSlot> tiles;
+    std::list<int> residentTiles;  // od ostatnio uzytego
+    std::size_t tileMaps = 0;
+
+    // pyramid[0] to min/max kafli, pyramid[l] laczy po 2x2 wezly poziomu l-1
+    std::vector<std::vector<TerrainMinMax>> pyramid;
+
+    std::unordered_map<int, TerrainMesh> meshes;
+    std::list<int> meshOrder;  // od ostatnio rysowanej
+
+    // polozenie probki (0, 0) w swiecie; srodek mapy wypada w srodku swiata
+    float originX = 0.0f;
+    float originZ = 0.0f;
+    // wysokosc pod srodkiem swiata, odejmowana od wszystkich, zeby mrowisko stalo na y = 0
+    float baseHeight = 0.0f;
+    // zasieg rysowania dobrany do rozmiaru kafla, zeby wszystkie widoczne siatki miescily sie w pamieci podrecznej
+    float viewDistance = TERRAIN_VIEW_DISTANCE;
+};
 
-            if (g_grassTexture != 0) {
-                glTexCoord2f(s, t1);
-            }
-            glVertex3f(x, 0.0f, z);
+Terrain g_terrain;
 
-            if (g_grassTexture != 0) {
-                glTexCoord2f(s, t2);
-            }
-            glVertex3f(x, 0.0f, z + step);
-        }
-        glEnd();
-    }
+std::uint32_t terrainLevelWidth(const Terrain& t, std::uint32_t level)
+{
+    return (t.header.tilesX + (1u << level) - 1) >> level;
+}
 
-    if (g_grassTexture != 0) {
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glDisable(GL_TEXTURE_2D);
-    }
+std::uint32_t terrainLevelHeight(const Terrain& t, std::uint32_t level)
+{
+    return (t.header.tilesZ + (1u << level) - 1) >> level;
 }
 
+void unmapTerrainTile(Terrain& t, int tile)
+{
+    TerrainTileSlot& slot = t.tiles[tile];
+    if (!slot.view) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(slot.view);
+#else
+    munmap(slot.view, slot.viewSize);
+#endif
+    slot.view = nullptr;
+    slot.samples = nullptr;
+    t.residentTiles.erase(slot.lru);
+}
 
-float getGroundHeightAt(float x, float z)
+// Probki kafla; mapuje go, jesli trzeba, i oznacza jako ostatnio uzyty.
+const std::uint16_t* terrainTile(Terrain& t, int tile)
 {
-    float r = std::sqrt(x * x + z * z);
+    TerrainTileSlot& slot = t.tiles[tile];
+    if (slot.samples) {
+        t.residentTiles.splice(t.residentTiles.begin(), t.residentTiles, slot.lru);
+        return slot.samples;
+    }
 
+    if (t.residentTiles.size() >= TERRAIN_MAX_RESIDENT_TILES)
+        unmapTerrainTile(t, t.residentTiles.back());
+
+    std::uint64_t offset = TERRAIN_DATA_OFFSET + static_cast<std::uint64_t>(tile) * TERRAIN_TILE_BYTES;
+    std::uint64_t aligned = offset - offset % t.granularity;
+    std::size_t size = static_cast<std::size_t>(offset - aligned + TERRAIN_TILE_BYTES);
+
+#ifdef _WIN32
+    void* view = MapViewOfFile(t.mapping, FILE_MAP_READ,
+        static_cast<DWORD>(aligned >> 32), static_cast<DWORD>(aligned & 0xffffffffu), size);
+#else
+    void* view = mmap(nullptr, size, PROT_READ, MAP_SHARED, t.fd, static_cast<off_t>(aligned));
+    if (view == MAP_FAILED) view = nullptr;
+#endif
+
+    if (!view) {
+        // brak pamieci adresowej albo uszkodzony plik: plaski kafel zamiast awarii
+        static const std::vector<std::uint16_t> flat(TERRAIN_TILE_SAMPLES * TERRAIN_TILE_SAMPLES, 0);
+        std::cerr << "Nie udalo sie zmapowac kafla terenu " << tile << std::endl;
+        return flat.data();
+    }
 
-    if (r >= ANTHILL_BASE_RADIUS)
-        return 0.0f;
+    slot.view = view;
+    slot.viewSize = size;
+    slot.samples = reinterpret_cast<const std::uint16_t*>(static_cast<const char*>(view) + (offset - aligned));
+    t.residentTiles.push_front(tile);
+    slot.lru = t.residentTiles.begin();
+    t.tileMaps++;
+    return slot.samples;
+}
 
+// Probka o globalnych indeksach (i, j), przycieta do mapy.
+float terrainSampleAt(Terrain& t, int i, int j)
+{
+    i = std::max(0, std::min(i, static_cast<int>(t.header.width) - 1));
+    j = std::max(0, std::min(j, static_cast<int>(t.header.height) - 1));
 
-    if (r >= ANTHILL_TOP_RADIUS) {
-        float t = (ANTHILL_BASE_RADIUS - r) / (ANTHILL_BASE_RADIUS - ANTHILL_TOP_RADIUS);
-        return ANTHILL_HEIGHT * t;
-    }
+    int tx = std::min(i / TERRAIN_TILE_CELLS, static_cast<int>(t.header.tilesX) - 1);
+    int tz = std::min(j / TERRAIN_TILE_CELLS, static_cast<int>(t.header.tilesZ) - 1);
+    const std::uint16_t* s = terrainTile(t, tz * static_cast<int>(t.header.tilesX) + tx);
 
-    if (r >= ANTHILL_HOLE_RADIUS)
-        return ANTHILL_HEIGHT;
+    int li = i - tx * TERRAIN_TILE_CELLS;
+    int lj = j - tz * TERRAIN_TILE_CELLS;
+    return s[lj * TERRAIN_TILE_SAMPLES + li] * t.header.heightScale - t.baseHeight;
+}
 
+// Komorka pod punktem (x, z): kafel, indeks lewego gornego naroznika w kafelku i ulamki do interpolacji.
+struct TerrainCell {
+    int tile;
+    int local;
+    float fx;
+    float fz;
+};
 
-    return ANTHILL_HEIGHT * 0.95f;
+TerrainCell terrainCellAt(const Terrain& t, float x, float z)
+{
+    float u = (x - t.originX) / t.header.cellSize;
+    float v = (z - t.originZ) / t.header.cellSize;
+    u = std::max(0.0f, std::min(u, static_cast<float>(t.header.width - 1)));
+    v = std::max(0.0f, std::min(v, static_cast<float>(t.header.height - 1)));
+
+    int i = std::min(static_cast<int>(u), static_cast<int>(t.header.width) - 2);
+    int j = std::min(static_cast<int>(v), static_cast<int>(t.header.height) - 2);
+    int tx = i / TERRAIN_TILE_CELLS;
+    int tz = j / TERRAIN_TILE_CELLS;
+
+    TerrainCell c;
+    c.tile = tz * static_cast<int>(t.header.tilesX) + tx;
+    c.local = (j - tz * TERRAIN_TILE_CELLS) * TERRAIN_TILE_SAMPLES + (i - tx * TERRAIN_TILE_CELLS);
+    c.fx = u - i;
+    c.fz = v - j;
+    return c;
 }
 
-void drawCube(float size)
+float terrainHeight(Terrain& t, float x, float z)
 {
-    float s = size * 0.5f;
+    TerrainCell c = terrainCellAt(t, x, z);
+    const std::uint16_t* s = terrainTile(t, c.tile) + c.local;
 
-    glBegin(GL_QUADS);
-    glNormal3f(0.0f, 1.0f, 0.0f);
-    glVertex3f(-s, s, -s);
-    glVertex3f(s, s, -s);
-    glVertex3f(s, s, s);
-    glVertex3f(-s, s, s);
+    float top = s[0] + (static_cast<float>(s[1]) - s[0]) * c.fx;
+    float bottom = s[TERRAIN_TILE_SAMPLES] + (static_cast<float>(s[TERRAIN_TILE_SAMPLES + 1]) - s[TERRAIN_TILE_SAMPLES]) * c.fx;
+    return (top + (bottom - top) * c.fz) * t.header.heightScale - t.baseHeight;
+}
 
-    glNormal3f(0.0f, -1.0f, 0.0f);
-    glVertex3f(-s, -s, -s);
-    glVertex3f(-s, -s, s);
-    glVertex3f(s, -s, s);
-    glVertex3f(s, -s, -s);
+// Normalna z gradientu tej samej interpolacji dwuliniowej, ktora daje terrainHeight.
+void terrainNormal(Terrain& t, float x, float z, float& nx, float& ny, float& nz)
+{
+    TerrainCell c = terrainCellAt(t, x, z);
+    const std::uint16_t* s = terrainTile(t, c.tile) + c.local;
+
+    float h00 = s[0];
+    float h10 = s[1];
+    float h01 = s[TERRAIN_TILE_SAMPLES];
+    float h11 = s[TERRAIN_TILE_SAMPLES + 1];
+
+    float k = t.header.heightScale / t.header.cellSize;
+    float dhdx = ((h10 - h00) * (1.0f - c.fz) + (h11 - h01) * c.fz) * k;
+    float dhdz = ((h01 - h00) * (1.0f - c.fx) + (h11 - h10) * c.fx) * k;
+
+    float len = std::sqrt(dhdx * dhdx + 1.0f + dhdz * dhdz);
+    nx = -dhdx / len;
+    ny = 1.0f / len;
+    nz = -dhdz / len;
+}
 
-    glNormal3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(-s, -s, s);
-    glVertex3f(s, -s, s);
-    glVertex3f(s, s, s);
-    glVertex3f(-s, s, s);
+// Wysokosci n punktow w ukladzie SoA. W blokach: najpierw arytmetyka wspolrzednych bez rozgalezien
+// (petla, ktora kompilator wektoryzuje), potem pobranie czterech probek z zapamietanym ostatnim kafelkiem,
+// bo mrowki sa skupione i kolejne punkty zwykle leza w tym samym kafelku.
+void terrainHeights(Terrain& t, const float* xs, const float* zs, float* out, std::size_t n)
+{
+    const std::size_t BLOCK = 64;
+    float u[BLOCK];
+    float v[BLOCK];
+
+    const float invCell = 1.0f / t.header.cellSize;
+    const float maxU = static_cast<float>(t.header.width - 1);
+    const float maxV = static_cast<float>(t.header.height - 1);
+    const int maxI = static_cast<int>(t.header.width) - 2;
+    const int maxJ = static_cast<int>(t.header.height) - 2;
+    const int tilesX = static_cast<int>(t.header.tilesX);
+
+    int lastTile = -1;
+    const std::uint16_t* tile = nullptr;
+
+    for (std::size_t b = 0; b < n; b += BLOCK) {
+        std::size_t m = std::min(BLOCK, n - b);
+
+        for (std::size_t k = 0; k < m; ++k) {
+            u[k] = std::max(0.0f, std::min((xs[b + k] - t.originX) * invCell, maxU));
+            v[k] = std::max(0.0f, std::min((zs[b + k] - t.originZ) * invCell, maxV));
+        }
 
-    glNormal3f(0.0f, 0.0f, -1.0f);
-    glVertex3f(-s, -s, -s);
-    glVertex3f(-s, s, -s);
-    glVertex3f(s, s, -s);
-    glVertex3f(s, -s, -s);
+        for (std::size_t k = 0; k < m; ++k) {
+            int i = std::min(static_cast<int>(u[k]), maxI);
+            int j = std::min(static_cast<int>(v[k]), maxJ);
+            int tx = i / TERRAIN_TILE_CELLS;
+            int tz = j / TERRAIN_TILE_CELLS;
 
-    glNormal3f(-1.0f, 0.0f, 0.0f);
-    glVertex3f(-s, -s, -s);
-    glVertex3f(-s, -s, s);
-    glVertex3f(-s, s, s);
-    glVertex3f(-s, s, -s);
+            int index = tz * tilesX + tx;
+            if (index != lastTile) {
+                tile = terrainTile(t, index);
+                lastTile = index;
+            }
 
-    glNormal3f(1.0f, 0.0f, 0.0f);
-    glVertex3f(s, -s, -s);
-    glVertex3f(s, s, -s);
-    glVertex3f(s, s, s);
-    glVertex3f(s, -s, s);
-    glEnd();
+            const std::uint16_t* s = tile + (j - tz * TERRAIN_TILE_CELLS) * TERRAIN_TILE_SAMPLES + (i - tx * TERRAIN_TILE_CELLS);
+            float fx = u[k] - i;
+            float fz = v[k] - j;
+            float top = s[0] + (static_cast<float>(s[1]) - s[0]) * fx;
+            float bottom = s[TERRAIN_TILE_SAMPLES] + (static_cast<float>(s[TERRAIN_TILE_SAMPLES + 1]) - s[TERRAIN_TILE_SAMPLES]) * fx;
+            out[b + k] = (top + (bottom - top) * fz) * t.header.heightScale - t.baseHeight;
+        }
+    }
 }
 
-void drawObstacles()
+void closeTerrain(Terrain& t)
 {
-    glColor3f(0.4f, 0.2f, 0.1f);
+    if (!t.loaded) return;
+
+    while (!t.residentTiles.empty())
+        unmapTerrainTile(t, t.residentTiles.back());
+
+#ifdef _WIN32
+    CloseHandle(t.mapping);
+    CloseHandle(t.file);
+    t.mapping = nullptr;
+    t.file = INVALID_HANDLE_VALUE;
+#else
+    close(t.fd);
+    t.fd = -1;
+#endif
+
+    t.tiles.clear();
+    t.pyramid.clear();
+    t.meshes.clear();
+    t.meshOrder.clear();
+    t.loaded = false;
+}
 
-    for (const auto& o : obstacles) {
-        glPushMatrix();
-        glTranslatef(o.x, o.y, o.z);
-        drawCube(o.size);
-        glPopMatrix();
+// Sprawdza naglowek wzgledem wzorow z convertHeightmap i rozmiaru pliku, zanim cokolwiek zostanie
+// odczytane albo zmapowane. Zwraca opis pierwszego problemu albo nullptr, gdy naglowek jest spojny.
+const char* terrainHeaderProblem(const TerrainHeader& h, std::uint64_t fileSize)
+{
+    if (h.magic != TERRAIN_MAGIC || h.version != TERRAIN_VERSION)
+        return "nieznany format";
+    if (h.width < 2 || h.height < 2)
+        return "mapa mniejsza niz 2 x 2 probki";
+    if (h.tilesX != (h.width - 2) / TERRAIN_TILE_CELLS + 1 || h.tilesZ != (h.height - 2) / TERRAIN_TILE_CELLS + 1)
+        return "liczba kafli nie zgadza sie z wymiarami mapy";
+    if (!(h.cellSize > 0.0f) || !std::isfinite(h.cellSize) || !std::isfinite(h.heightScale))
+        return "nieprawidlowy cellSize albo heightScale";
+
+    // piramida konczy sie na jednym wezle, wiec poziomow jest tyle, ile podzialow 2x2 i jeszcze jeden
+    std::uint32_t levels = 1;
+    std::uint64_t pyramidNodes = static_cast<std::uint64_t>(h.tilesX) * h.tilesZ;
+    for (std::uint32_t lw = h.tilesX, lh = h.tilesZ; lw > 1 || lh > 1; ++levels) {
+        lw = (lw + 1) / 2;
+        lh = (lh + 1) / 2;
+        pyramidNodes += static_cast<std::uint64_t>(lw) * lh;
     }
+    if (h.levels != levels)
+        return "liczba poziomow piramidy nie zgadza sie z liczba kafli";
+
+    std::uint64_t tiles = static_cast<std::uint64_t>(h.tilesX) * h.tilesZ;
+    if (fileSize < TERRAIN_DATA_OFFSET || tiles > (fileSize - TERRAIN_DATA_OFFSET) / TERRAIN_TILE_BYTES)
+        return "plik jest krotszy niz kafle z naglowka";
+    if (h.pyramidOffset != TERRAIN_DATA_OFFSET + tiles * TERRAIN_TILE_BYTES)
+        return "piramida nie zaczyna sie za ostatnim kaflem";
+    if (pyramidNodes > (fileSize - h.pyramidOffset) / sizeof(TerrainMinMax))
+        return "plik jest krotszy niz piramida";
+    return nullptr;
 }
 
-void addRandomObstacle()
+bool openTerrain(Terrain& t, const std::string& path)
 {
-    if (obstacles.size() >= MAX_OBSTACLES)
-        return;
-
-    Obstacle o;
-    o.size = 6.0f;
-
-    float HALF_SIZE = 50.0f - o.size;
+    closeTerrain(t);
 
-    float rx = (std::rand() % 1000) / 1000.0f;
-    float rz = (std::rand() % 1000) / 1000.0f;
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    std::uint64_t fileSize = in ? static_cast<std::uint64_t>(in.tellg()) : 0;
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char*>(&t.header), sizeof(t.header))) {
+        std::cerr << "Nieprawidlowy plik terenu " << path << std::endl;
+        return false;
+    }
+    if (const char* problem = terrainHeaderProblem(t.header, fileSize)) {
+        std::cerr << "Nieprawidlowy plik terenu " << path << ": " << problem << std::endl;
+        return false;
+    }
 
-    o.x = -HALF_SIZE + 2.0f * HALF_SIZE * rx;
-    o.z = -HALF_SIZE + 2.0f * HALF_SIZE * rz;
+    in.seekg(static_cast<std::streamoff>(t.header.pyramidOffset));
+    t.pyramid.resize(t.header.levels);
+    for (std::uint32_t l = 0; l < t.header.levels; ++l) {
+        t.pyramid[l].resize(static_cast<std::size_t>(terrainLevelWidth(t, l)) * terrainLevelHeight(t, l));
+        in.read(reinterpret_cast<char*>(t.pyramid[l].data()), t.pyramid[l].size() * sizeof(TerrainMinMax));
+    }
+    if (!in) {
+        std::cerr << "Uszkodzona piramida w pliku terenu " << path << std::endl;
+        return false;
+    }
 
-    float groundY = getGroundHeightAt(o.x, o.z);
-    o.y = groundY + o.size * 0.5f;
+#ifdef _WIN32
+    t.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (t.file == INVALID_HANDLE_VALUE)
+        return false;
+    t.mapping = CreateFileMappingA(t.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!t.mapping) {
+        CloseHandle(t.file);
+        t.file = INVALID_HANDLE_VALUE;
+        return false;
+    }
 
-    obstacles.push_back(o);
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    t.granularity = info.dwAllocationGranularity;
+#else
+    t.fd = open(path.c_str(), O_RDONLY);
+    if (t.fd < 0)
+        return false;
+    t.granularity = static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+
+    t.tiles.assign(static_cast<std::size_t>(t.header.tilesX) * t.header.tilesZ, TerrainTileSlot());
+    t.tileMaps = 0;
+    t.loaded = true;
+
+    t.originX = -0.5f * (t.header.width - 1) * t.header.cellSize;
+    t.originZ = -0.5f * (t.header.height - 1) * t.header.cellSize;
+    t.baseHeight = 0.0f;
+    t.baseHeight = terrainHeight(t, 0.0f, 0.0f);
+
+    // Kafel siegajacy kola widoku lezy caly w kole o promieniu wiekszym o przekatna kafla, wiec kafli
+    // w zasiegu jest najwyzej tyle, ile pol kafla miesci sie w tym kole. Przy drobnym cellSize zasieg
+    // jest skracany tak, zeby ta liczba nie przekroczyla TERRAIN_MAX_MESHES (i TERRAIN_MAX_RESIDENT_TILES)
+    // i siatki nie byly przebudowywane w kazdej klatce.
+    float span = TERRAIN_TILE_CELLS * t.header.cellSize;
+    float fitTiles = std::sqrt(static_cast<float>(std::min(TERRAIN_MAX_MESHES, TERRAIN_MAX_RESIDENT_TILES)) / 3.14159265f);
+    t.viewDistance = std::min(TERRAIN_VIEW_DISTANCE, span * (fitTiles - std::sqrt(2.0f)));
+
+    std::cout << "Teren " << path << ": " << t.header.width << " x " << t.header.height << " probek, "
+        << t.tiles.size() << " kafli, " << t.header.levels << " poziomow piramidy, zasieg widoku "
+        << t.viewDistance << "\n";
+    return true;
 }
 
-void drawAnthill()
+// Zamienia surowa mape 16-bit na plik kafli z piramida min/max. Czyta po jednym pasie kafli,
+// wiec nawet wielogigabajtowe mapy nie musza sie miescic w pamieci.
+int convertHeightmap(int argc, char* argv[])
+{
+    if (argc < 4) {
+        std::cerr << "Uzycie: --terrain-convert mapa.r16 szerokosc wysokosc wynik.terrain [cellSize] [heightScale]" << std::endl;
+        return 1;
+    }
+
+    std::string inPath = argv[0];
+    long long width = std::atoll(argv[1]);
+    long long height = std::atoll(argv[2]);
+    std::string outPath = argv[3];
+    float cellSize = argc > 4 ? static_cast<float>(std::atof(argv[4])) : 0.25f;
+    float heightScale = argc > 5 ? static_cast<float>(std::atof(argv[5])) : 0.001f;
+
+    if (width < 2 || height < 2 || width > 0xffffffffLL || height > 0xffffffffLL || cellSize <= 0.0f) {
+        std::cerr << "Nieprawidlowe wymiary mapy" << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(inPath, std::ios::binary);
+    std::ofstream out(outPath, std::ios::binary);
+    if (!in || !out) {
+        std::cerr << "Nie udalo sie otworzyc " << (in ? outPath : inPath) << std::endl;
+        return 1;
+    }
+
+    TerrainHeader h;
+    std::memset(&h, 0, sizeof(h));
+    h.magic = TERRAIN_MAGIC;
+    h.version = TERRAIN_VERSION;
+    h.width = static_cast<std::uint32_t>(width);
+    h.height = static_cast<std::uint32_t>(height);
+    h.tilesX = static_cast<std::uint32_t>((width - 2) / TERRAIN_TILE_CELLS + 1);
+    h.tilesZ = static_cast<std::uint32_t>((height - 2) / TERRAIN_TILE_CELLS + 1);
+    h.cellSize = cellSize;
+    h.heightScale = heightScale;
+
+    std::vector<char> padding(static_cast<std::size_t>(TERRAIN_DATA_OFFSET), 0);
+    out.write(padding.data(), padding.size());
+
+    std::vector<TerrainMinMax> tileRange(static_cast<std::size_t>(h.tilesX) * h.tilesZ);
+    std::vector<std::uint16_t> band(static_cast<std::size_t>(width) * TERRAIN_TILE_SAMPLES);
+    std::vector<std::uint16_t> tile(TERRAIN_TILE_SAMPLES * TERRAIN_TILE_SAMPLES);
+
+    for (std::uint32_t tz = 0; tz < h.tilesZ; ++tz) {
+        long long row0 = static_cast<long long>(tz) * TERRAIN_TILE_CELLS;
+        long long rows = std::min<long long>(TERRAIN_TILE_SAMPLES, height - row0);
+
+        in.seekg(static_cast<std::streamoff>(row0 * width * 2));
+        in.read(reinterpret_cast<char*>(band.data()), static_cast<std::streamsize>(rows * width * 2));
+        if (!in) {
+            std::cerr << "Plik " << inPath << " jest krotszy niz " << width << " x " << height << " probek" << std::endl;
+            return 1;
+        }
+
+        for (std::uint32_t tx = 0; tx < h.tilesX; ++tx) {
+            long long col0 = static_cast<long long>(tx) * TERRAIN_TILE_CELLS;
+            TerrainMinMax range = { 0xffff, 0 };
+
+            // za krawedzia mapy powtarzamy ostatni wiersz i kolumne
+            for (int lj = 0; lj < TERRAIN_TILE_SAMPLES; ++lj) {
+                long long r = std::min<long long>(lj, rows - 1);
+                for (int li = 0; li < TERRAIN_TILE_SAMPLES; ++li) {
+                    long long c = std::min<long long>(col0 + li, width - 1);
+                    std::uint16_t s = band[static_cast<std::size_t>(r * width + c)];
+                    tile[lj * TERRAIN_TILE_SAMPLES + li] = s;
+                    range.min = std::min(range.min, s);
+                    range.max = std::max(range.max, s);
+                }
+            }
+
+            tileRange[static_cast<std::size_t>(tz) * h.tilesX + tx] = range;
+            out.write(reinterpret_cast<const char*>(tile.data()), static_cast<std::streamsize>(TERRAIN_TILE_BYTES));
+        }
+
+        std::cout << "\r" << (tz + 1) << " / " << h.tilesZ << std::flush;
+    }
+    std::cout << "\n";
+
+    // piramida: poziom 0 to kafle, kazdy nastepny laczy 2x2 wezly, az zostanie jeden
+    h.pyramidOffset = TERRAIN_DATA_OFFSET + static_cast<std::uint64_t>(tileRange.size()) * TERRAIN_TILE_BYTES;
+
+    std::vector<TerrainMinMax> level = tileRange;
+    std::uint32_t lw = h.tilesX;
+    std::uint32_t lh = h.tilesZ;
+    for (;;) {
+        out.write(reinterpret_cast<const char*>(level.data()), static_cast<std::streamsize>(level.size() * sizeof(TerrainMinMax)));
+        h.levels++;
+        if (lw == 1 && lh == 1) break;
+
+        std::uint32_t nw = (lw + 1) / 2;
+        std::uint32_t nh = (lh + 1) / 2;
+        std::vector<TerrainMinMax> up(static_cast<std::size_t>(nw) * nh, TerrainMinMax{ 0xffff, 0 });
+        for (std::uint32_t z = 0; z < lh; ++z) {
+            for (std::uint32_t x = 0; x < lw; ++x) {
+                const TerrainMinMax& r = level[static_cast<std::size_t>(z) * lw + x];
+                TerrainMinMax& p = up[static_cast<std::size_t>(z / 2) * nw + x / 2];
+                p.min = std::min(p.min, r.min);
+                p.max = std::max(p.max, r.max);
+            }
+        }
+
+        level.swap(up);
+        lw = nw;
+        lh = nh;
+    }
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    if (!out) {
+        std::cerr << "Blad zapisu " << outPath << std::endl;
+        return 1;
+    }
+
+    std::cout << "Zapisano " << outPath << ": " << h.tilesX << " x " << h.tilesZ << " kafli, "
+        << h.levels << " poziomow piramidy\n";
+    return 0;
+}
+
+// Pozycja kamery z katow i odleglosci; nad terenem trzyma co najmniej 1 jednostke.
+void cameraEye(float& eyeX, float& eyeY, float& eyeZ)
+{
+    float radY = camAngleY * 3.14159265f / 180.0f;
+    float radX = camAngleX * 3.14159265f / 180.0f;
+
+    eyeX = camDist * std::cos(radX) * std::sin(radY);
+    eyeY = camDist * std::sin(radX);
+    eyeZ = camDist * std::cos(radX) * std::cos(radY);
+
+    float minCameraHeight = 1.0f;
+    if (g_terrain.loaded)
+        minCameraHeight += std::max(0.0f, terrainHeight(g_terrain, eyeX, eyeZ));
+    if (eyeY < minCameraHeight)
+        eyeY = minCameraHeight;
+}
+
+// Siatka kafla co 2^lod probek, z "fartuchem" opuszczonym wzdluz brzegow, ktory zaslania szpary
+// miedzy sasiednimi kaflami o roznym LOD.
+void buildTerrainMesh(Terrain& t, int tile, int lod, TerrainMesh& m)
+{
+    const int stride = 1 << lod;
+    const int n = TERRAIN_TILE_CELLS / stride + 1;
+    const int tilesX = static_cast<int>(t.header.tilesX);
+    const int gi0 = (tile % tilesX) * TERRAIN_TILE_CELLS;
+    const int gj0 = (tile / tilesX) * TERRAIN_TILE_CELLS;
+    const float cell = t.header.cellSize;
+
+    m.lod = lod;
+    m.vertices.clear();
+    m.normals.clear();
+    m.texCoords.clear();
+    m.indices.clear();
+
+    const std::uint16_t* s = terrainTile(t, tile);
+    auto sample = [&](int li, int lj) {
+        if (li >= 0 && li < TERRAIN_TILE_SAMPLES && lj >= 0 && lj < TERRAIN_TILE_SAMPLES)
+            return s[lj * TERRAIN_TILE_SAMPLES + li] * t.header.heightScale - t.baseHeight;
+        return terrainSampleAt(t, gi0 + li, gj0 + lj);
+    };
+
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            int li = i * stride;
+            int lj = j * stride;
+            float x = t.originX + (gi0 + li) * cell;
+            float z = t.originZ + (gj0 + lj) * cell;
+
+            float dhdx = (sample(li + stride, lj) - sample(li - stride, lj)) / (2.0f * stride * cell);
+            float dhdz = (sample(li, lj + stride) - sample(li, lj - stride)) / (2.0f * stride * cell);
+            float len = std::sqrt(dhdx * dhdx + 1.0f + dhdz * dhdz);
+
+            m.vertices.insert(m.vertices.end(), { x, sample(li, lj), z });
+            m.normals.insert(m.normals.end(), { -dhdx / len, 1.0f / len, -dhdz / len });
+            m.texCoords.insert(m.texCoords.end(), { x * TERRAIN_TEX_SCALE, z * TERRAIN_TEX_SCALE });
+        }
+    }
+
+    for (int j = 0; j + 1 < n; ++j) {
+        for (int i = 0; i + 1 < n; ++i) {
+            GLuint a = static_cast<GLuint>(j * n + i);
+            GLuint b = a + 1;
+            GLuint c = a + static_cast<GLuint>(n);
+            GLuint d = c + 1;
+            m.indices.insert(m.indices.end(), { a, c, b, b, c, d });
+        }
+    }
+
+    // obwod kafla w kolejnosci, dla kazdego punktu kopia opuszczona o glebokosc fartucha
+    std::vector<int> rim;
+    for (int i = 0; i < n - 1; ++i) rim.push_back(i);
+    for (int j = 0; j < n - 1; ++j) rim.push_back(j * n + n - 1);
+    for (int i = n - 1; i > 0; --i) rim.push_back((n - 1) * n + i);
+    for (int j = n - 1; j > 0; --j) rim.push_back(j * n);
+
+    const TerrainMinMax& range = t.pyramid[0][tile];
+    float skirt = (range.max - range.min) * t.header.heightScale + stride * cell;
+
+    GLuint first = static_cast<GLuint>(m.vertices.size() / 3);
+    for (int v : rim) {
+        m.vertices.insert(m.vertices.end(), { m.vertices[v * 3], m.vertices[v * 3 + 1] - skirt, m.vertices[v * 3 + 2] });
+        m.normals.insert(m.normals.end(), { m.normals[v * 3], m.normals[v * 3 + 1], m.normals[v * 3 + 2] });
+        m.texCoords.insert(m.texCoords.end(), { m.texCoords[v * 2], m.texCoords[v * 2 + 1] });
+    }
+    for (std::size_t k = 0; k < rim.size(); ++k) {
+        std::size_t k2 = (k + 1) % rim.size();
+        GLuint a = static_cast<GLuint>(rim[k]);
+        GLuint b = static_cast<GLuint>(rim[k2]);
+        GLuint c = first + static_cast<GLuint>(k);
+        GLuint d = first + static_cast<GLuint>(k2);
+        m.indices.insert(m.indices.end(), { a, c, b, b, c, d });
+    }
+}
+
+// Siatka kafla w zadanym LOD z pamieci podrecznej (LRU); przebudowywana przy zmianie LOD.
+const TerrainMesh& terrainMesh(Terrain& t, int tile, int lod)
+{
+    auto it = t.meshes.find(tile);
+    if (it == t.meshes.end()) {
+        if (t.meshes.size() >= TERRAIN_MAX_MESHES) {
+            t.meshes.erase(t.meshOrder.back());
+            t.meshOrder.pop_back();
+        }
+        it = t.meshes.emplace(tile, TerrainMesh()).first;
+        t.meshOrder.push_front(tile);
+        it->second.lru = t.meshOrder.begin();
+    }
+    else {
+        t.meshOrder.splice(t.meshOrder.begin(), t.meshOrder, it->second.lru);
+    }
+
+    TerrainMesh& m = it->second;
+    if (m.lod != lod)
+        buildTerrainMesh(t, tile, lod, m);
+    return m;
+}
+
+// Schodzi po piramidzie od korzenia; wezly, ktorych prostopadloscian min/max jest dalej niz
+// t.viewDistance, odpadaja razem z poddrzewem, a kafle dostaja LOD wedlug odleglosci.
+void drawTerrainNode(Terrain& t, std::uint32_t level, std::uint32_t nx, std::uint32_t nz, float ex, float ey, float ez)
+{
+    if (nx >= terrainLevelWidth(t, level) || nz >= terrainLevelHeight(t, level))
+        return;
+
+    const TerrainMinMax& range = t.pyramid[level][static_cast<std::size_t>(nz) * terrainLevelWidth(t, level) + nx];
+    float span = static_cast<float>(TERRAIN_TILE_CELLS << level) * t.header.cellSize;
+
+    float minX = t.originX + nx * span;
+    float minZ = t.originZ + nz * span;
+    float minY = range.min * t.header.heightScale - t.baseHeight;
+    float maxY = range.max * t.header.heightScale - t.baseHeight;
+
+    float dx = std::max(0.0f, std::max(minX - ex, ex - (minX + span)));
+    float dy = std::max(0.0f, std::max(minY - ey, ey - maxY));
+    float dz = std::max(0.0f, std::max(minZ - ez, ez - (minZ + span)));
+    float dist = std::sqrt(dx * dx + dy * dy + dz * dz);
+    if (dist > t.viewDistance)
+        return;
+
+    if (level > 0) {
+        for (std::uint32_t c = 0; c < 4; ++c)
+            drawTerrainNode(t, level - 1, nx * 2 + (c & 1), nz * 2 + (c >> 1), ex, ey, ez);
+        return;
+    }
+
+    int lod = 0;
+    for (float d = TERRAIN_LOD_DISTANCE; dist > d && lod < TERRAIN_MAX_LOD; d *= 2.0f)
+        ++lod;
+
+    const TerrainMesh& m = terrainMesh(t, static_cast<int>(nz * t.header.tilesX + nx), lod);
+    glVertexPointer(3, GL_FLOAT, 0, m.vertices.data());
+    glNormalPointer(GL_FLOAT, 0, m.normals.data());
+    glTexCoordPointer(2, GL_FLOAT, 0, m.texCoords.data());
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(m.indices.size()), GL_UNSIGNED_INT, m.indices.data());
+}
+
+void drawTerrain(Terrain& t)
+{
+    float ex, ey, ez;
+    cameraEye(ex, ey, ez);
+
+    if (g_grassTexture != 0) {
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, g_grassTexture);
+        glColor3f(1.0f, 1.0f, 1.0f);
+    }
+    else {
+        glDisable(GL_TEXTURE_2D);
+        glColor3f(0.2f, 0.6f, 0.2f);
+    }
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+    drawTerrainNode(t, t.header.levels - 1, 0, 0, ex, ey, ez);
+
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    if (g_grassTexture != 0) {
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDisable(GL_TEXTURE_2D);
+    }
+}
+
+void drawGround()
+{
+    float size = 50.0f;
+    float step = 2.0f;
+
+    glNormal3f(0.0f, 1.0f, 0.0f);
+
+    float texScale = 0.2f;
+
+    if (g_grassTexture != 0) {
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, g_grassTexture);
+        glColor3f(1.0f, 1.0f, 1.0f); 
+    }
+    else {
+        glDisable(GL_TEXTURE_2D);
+        glColor3f(0.2f, 0.6f, 0.2f);
+    }
+
+    for (float z = -size; z < size; z += step) {
+        glBegin(GL_TRIANGLE_STRIP);
+        for (float x = -size; x <= size; x += step) {
+
+            float s = (x + size) * texScale;
+            float t1 = (z + size) * texScale;
+            float t2 = (z + step + size) * texScale;
+
+            if (g_grassTexture != 0) {
+                glTexCoord2f(s, t1);
+            }
+            glVertex3f(x, 0.0f, z);
+
+            if (g_grassTexture != 0) {
+                glTexCoord2f(s, t2);
+            }
+            glVertex3f(x, 0.0f, z + step);
+        }
+        glEnd();
+    }
+
+    if (g_grassTexture != 0) {
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDisable(GL_TEXTURE_2D);
+    }
+}
+
+
+float anthillHeightAt(float x, float z)
+{
+    float r = std::sqrt(x * x + z * z);
+
+
+    if (r >= ANTHILL_BASE_RADIUS)
+        return 0.0f;
+
+
+    if (r >= ANTHILL_TOP_RADIUS) {
+        float t = (ANTHILL_BASE_RADIUS - r) / (ANTHILL_BASE_RADIUS - ANTHILL_TOP_RADIUS);
+        return ANTHILL_HEIGHT * t;
+    }
+
+    if (r >= ANTHILL_HOLE_RADIUS)
+        return ANTHILL_HEIGHT;
+
+
+    return ANTHILL_HEIGHT * 0.95f;
+}
+
+// Z wczytanym terenem mrowisko stoi na nim (teren pod srodkiem swiata ma y = 0).
+float getGroundHeightAt(float x, float z)
+{
+    if (g_terrain.loaded)
+        return std::max(terrainHeight(g_terrain, x, z), anthillHeightAt(x, z));
+    return anthillHeightAt(x, z);
+}
+
+float antHeightAt(float x, float z)
+{
+    return getGroundHeightAt(x, z) + 0.1f;
+}
+
+// antHeightAt dla wielu mrowek naraz (tablice SoA, jak w eksporcie stanu).
+void antHeightsAt(const float* xs, const float* zs, float* ys, std::size_t n)
+{
+    if (!g_terrain.loaded) {
+        for (std::size_t i = 0; i < n; ++i)
+            ys[i] = antHeightAt(xs[i], zs[i]);
+        return;
+    }
+
+    terrainHeights(g_terrain, xs, zs, ys, n);
+    for (std::size_t i = 0; i < n; ++i) {
+        if (xs[i] * xs[i] + zs[i] * zs[i] < ANTHILL_BASE_RADIUS * ANTHILL_BASE_RADIUS)
+            ys[i] = std::max(ys[i], anthillHeightAt(xs[i], zs[i]));
+        ys[i] += 0.1f;
+    }
+}
+
+void drawCube(float size)
+{
+    float s = size * 0.5f;
+
+    glBegin(GL_QUADS);
+    glNormal3f(0.0f, 1.0f, 0.0f);
+    glVertex3f(-s, s, -s);
+    glVertex3f(s, s, -s);
+    glVertex3f(s, s, s);
+    glVertex3f(-s, s, s);
+
+    glNormal3f(0.0f, -1.0f, 0.0f);
+    glVertex3f(-s, -s, -s);
+    glVertex3f(-s, -s, s);
+    glVertex3f(s, -s, s);
+    glVertex3f(s, -s, -s);
+
+    glNormal3f(0.0f, 0.0f, 1.0f);
+    glVertex3f(-s, -s, s);
+    glVertex3f(s, -s, s);
+    glVertex3f(s, s, s);
+    glVertex3f(-s, s, s);
+
+    glNormal3f(0.0f, 0.0f, -1.0f);
+    glVertex3f(-s, -s, -s);
+    glVertex3f(-s, s, -s);
+    glVertex3f(s, s, -s);
+    glVertex3f(s, -s, -s);
+
+    glNormal3f(-1.0f, 0.0f, 0.0f);
+    glVertex3f(-s, -s, -s);
+    glVertex3f(-s, -s, s);
+    glVertex3f(-s, s, s);
+    glVertex3f(-s, s, -s);
+
+    glNormal3f(1.0f, 0.0f, 0.0f);
+    glVertex3f(s, -s, -s);
+    glVertex3f(s, s, -s);
+    glVertex3f(s, s, s);
+    glVertex3f(s, -s, s);
+    glEnd();
+}
+
+void drawObstacles(const World& world)
+{
+    glColor3f(0.4f, 0.2f, 0.1f);
+
+    for (const auto& o : world.obstacles) {
+        glPushMatrix();
+        glTranslatef(o.x, o.y, o.z);
+        drawCube(o.size);
+        glPopMatrix();
+    }
+}
+
+int flowCellAt(float x, float z)
+{
+    int cx = static_cast<int>((x + WORLD_HALF_SIZE) / FLOW_CELL_SIZE);
+    int cz = static_cast<int>((z + WORLD_HALF_SIZE) / FLOW_CELL_SIZE);
+    if (cx < 0) cx = 0;
+    if (cx >= FLOW_GRID) cx = FLOW_GRID - 1;
+    if (cz < 0) cz = 0;
+    if (cz >= FLOW_GRID) cz = FLOW_GRID - 1;
+    return cz * FLOW_GRID + cx;
+}
+
+void flowCellCenter(int cell, float& x, float& z)
+{
+    x = -WORLD_HALF_SIZE + (cell % FLOW_GRID + 0.5f) * FLOW_CELL_SIZE;
+    z = -WORLD_HALF_SIZE + (cell / FLOW_GRID + 0.5f) * FLOW_CELL_SIZE;
+}
+
+// Czy odcinek od (x, z) do gniazda przechodzi w zasiegu unikania przeszkody o.
+bool obstacleBlocksNestPath(float x, float z, const Obstacle& o, float margin)
+{
+    float len2 = x * x + z * z;
+    if (len2 < 0.0001f)
+        return false;
+
+    float obstacleRadius = std::sqrt(2.0f) * (o.size * 0.5f) + margin;
+
+    // najblizszy punkt odcinka (x, z) -> (0, 0) do srodka przeszkody
+    float t = (x * (x - o.x) + z * (z - o.z)) / len2;
+    if (t < 0.0f) t = 0.0f;
+    if (t > 1.0f) t = 1.0f;
+
+    float px = x - x * t;
+    float pz = z - z * t;
+    float dx = px - o.x;
+    float dz = pz - o.z;
+    return dx * dx + dz * dz < obstacleRadius * obstacleRadius;
+}
+
+// Aktualizuje liczniki blokad i cieni dla jednej przeszkody (delta = +1 dodanie, -1 usuniecie)
+// i zapamietuje zmienione komorki do nastepnego repairFlowField.
+void flowObstacleChanged(FlowField& flow, const Obstacle& o, int delta)
+{
+    if (!flow.built) return;
+
+    // ten sam okrag, w ktorym dziala avoidObstacles, zeby droga nie wchodzila w strefe odpychania
+    float reach = std::sqrt(2.0f) * (o.size * 0.5f) + OBSTACLE_MARGIN;
+    int minCell = flowCellAt(o.x - reach, o.z - reach);
+    int maxCell = flowCellAt(o.x + reach, o.z + reach);
+
+    for (int cz = minCell / FLOW_GRID; cz <= maxCell / FLOW_GRID; ++cz) {
+        for (int cx = minCell % FLOW_GRID; cx <= maxCell % FLOW_GRID; ++cx) {
+            int cell = cz * FLOW_GRID + cx;
+            float x, z;
+            flowCellCenter(cell, x, z);
+            float dx = x - o.x;
+            float dz = z - o.z;
+            if (dx * dx + dz * dz >= reach * reach) continue;
+
+            flow.blockers[cell] = static_cast<std::uint16_t>(flow.blockers[cell] + delta);
+            if (delta > 0 && flow.blockers[cell] == 1)
+                flow.newlyBlocked.push_back(cell);
+            else if (delta < 0 && flow.blockers[cell] == 0)
+                flow.dirty.push_back(cell);
+            else
+                continue;
+            flow.aimSources.push_back(cell);
+        }
+    }
+
+    // Cien przeszkody to klin z wierzcholkiem w gniezdzie, styczny do jej okregu unikania: kazdy punkt
+    // odcinka do gniazda lezy na tym samym promieniu co jego koniec. Dla kazdego wiersza klin daje
+    // przedzial kolumn (z zapasem), a dokladny test robimy tylko w nim.
+    float dist = std::sqrt(o.x * o.x + o.z * o.z);
+    float halfAngle = dist > reach ? std::asin(reach / dist) + 0.05f : 3.2f;
+    bool wholeGrid = halfAngle >= 1.5f;
+
+    float base = std::atan2(o.z, o.x);
+    float leftX = std::cos(base + halfAngle);
+    float leftZ = std::sin(base + halfAngle);
+    float rightX = std::cos(base - halfAngle);
+    float rightZ = std::sin(base - halfAngle);
+
+    for (int cz = 0; cz < FLOW_GRID; ++cz) {
+        int cxMin = 0;
+        int cxMax = FLOW_GRID - 1;
+
+        if (!wholeGrid) {
+            float z = -WORLD_HALF_SIZE + (cz + 0.5f) * FLOW_CELL_SIZE;
+            float xMin = -2.0f * WORLD_HALF_SIZE;
+            float xMax = 2.0f * WORLD_HALF_SIZE;
+
+            // punkt (x, z) jest w klinie, gdy lezy na lewo od prawego boku i na prawo od lewego:
+            // -rightZ * x >= -rightX * z oraz leftZ * x >= leftX * z
+            const float coef[2] = { -rightZ, leftZ };
+            const float rhs[2] = { -rightX * z, leftX * z };
+            for (int k = 0; k < 2; ++k) {
+                if (coef[k] > 0.0f) xMin = std::max(xMin, rhs[k] / coef[k]);
+                else if (coef[k] < 0.0f) xMax = std::min(xMax, rhs[k] / coef[k]);
+                else if (rhs[k] > 0.0f) xMax = xMin - 1.0f;
+            }
+            if (xMax < xMin) continue;
+
+            cxMin = std::max(0, static_cast<int>(std::floor((xMin + WORLD_HALF_SIZE) / FLOW_CELL_SIZE)) - 1);
+            cxMax = std::min(FLOW_GRID - 1, static_cast<int>(std::floor((xMax + WORLD_HALF_SIZE) / FLOW_CELL_SIZE)) + 1);
+        }
+
+        for (int cx = cxMin; cx <= cxMax; ++cx) {
+            int cell = cz * FLOW_GRID + cx;
+            float x, z;
+            flowCellCenter(cell, x, z);
+            if (obstacleBlocksNestPath(x, z, o, OBSTACLE_MARGIN)) {
+                flow.shadows[cell] = static_cast<std::uint16_t>(flow.shadows[cell] + delta);
+                if (flow.shadows[cell] == (delta > 0 ? 1 : 0))
+                    flow.aimCells.push_back(cell);
+            }
+        }
+    }
+}
+
+struct FlowQueueItem {
+    float cost;
+    int cell;
+
+    bool operator>(const FlowQueueItem& other) const { return cost > other.cost; }
+};
+
+typedef std::priority_queue<FlowQueueItem, std::vector<FlowQueueItem>, std::greater<FlowQueueItem>> FlowQueue;
+
+const int FLOW_DX[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+const int FLOW_DZ[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+
+// Sasiad w kierunku k albo -1; po przekatnej tylko, gdy obie komorki boczne sa wolne.
+int flowNeighbour(const FlowField& flow, int cell, int k)
+{
+    int cx = cell % FLOW_GRID + FLOW_DX[k];
+    int cz = cell / FLOW_GRID + FLOW_DZ[k];
+    if (cx < 0 || cx >= FLOW_GRID || cz < 0 || cz >= FLOW_GRID)
+        return -1;
+
+    if (k >= 4) {
+        if (flow.blockers[cell - cell % FLOW_GRID + cx] != 0) return -1;
+        if (flow.blockers[cz * FLOW_GRID + cell % FLOW_GRID] != 0) return -1;
+    }
+    return cz * FLOW_GRID + cx;
+}
+
+// Dijkstra z poprawianiem etykiet: relaksuje tylko tam, gdzie koszt faktycznie maleje.
+std::size_t flowRelax(FlowField& flow, FlowQueue& queue)
+{
+    const float DIAGONAL = std::sqrt(2.0f) * FLOW_CELL_SIZE;
+    std::size_t touched = 0;
+
+    while (!queue.empty()) {
+        FlowQueueItem item = queue.top();
+        queue.pop();
+        if (item.cost > flow.cost[item.cell]) continue;
+        ++touched;
+
+        for (int k = 0; k < 8; ++k) {
+            int n = flowNeighbour(flow, item.cell, k);
+            if (n < 0 || flow.blockers[n] != 0) continue;
+
+            float c = item.cost + (k < 4 ? FLOW_CELL_SIZE : DIAGONAL);
+            if (c < flow.cost[n]) {
+                flow.cost[n] = c;
+                flow.next[n] = item.cell;
+                flow.aimSources.push_back(n);
+                queue.push({ c, n });
+            }
+        }
+    }
+    return touched;
+}
+
+bool isNestCell(int cell)
+{
+    float x, z;
+    flowCellCenter(cell, x, z);
+    return x * x + z * z < NEST_RADIUS * NEST_RADIUS;
+}
+
+// Czy odcinek od (x, z) do srodka komorki cell nie przechodzi przez zablokowane komorki.
+bool flowLineIsClear(const FlowField& flow, float x, float z, int cell)
+{
+    float tx, tz;
+    flowCellCenter(cell, tx, tz);
+    float dx = tx - x;
+    float dz = tz - z;
+    int samples = static_cast<int>(std::sqrt(dx * dx + dz * dz) / (FLOW_CELL_SIZE * 0.5f)) + 1;
+
+    for (int k = 1; k <= samples; ++k) {
+        float t = static_cast<float>(k) / samples;
+        if (flow.blockers[flowCellAt(x + dx * t, z + dz * t)] != 0)
+            return false;
+    }
+    return true;
+}
+
+// Czy komorka target jest widoczna w linii prostej z kazdego naroznika komorki cell (i z jej srodka),
+// czyli z dowolnego miejsca, w ktorym moze stac mrowka.
+bool flowCellSeesCell(const FlowField& flow, int cell, int target)
+{
+    const float INSET = 0.45f * FLOW_CELL_SIZE;
+    const float CORNER_X[5] = { 0.0f, -INSET, INSET, -INSET, INSET };
+    const float CORNER_Z[5] = { 0.0f, -INSET, -INSET, INSET, INSET };
+
+    float x, z;
+    flowCellCenter(cell, x, z);
+    for (int k = 0; k < 5; ++k) {
+        if (!flowLineIsClear(flow, x + CORNER_X[k], z + CORNER_Z[k], target))
+            return false;
+    }
+    return true;
+}
+
+// Cel mrowki z komorki cell: najdalsza (do FLOW_LOOKAHEAD krokow) komorka drogi widoczna w linii prostej,
+// zeby nie isc schodkami po siatce.
+int flowAimFrom(const FlowField& flow, int cell)
+{
+    int target = flow.next[cell];
+    if (flow.blockers[cell] != 0) {
+        // mrowka zepchnieta w strefe przeszkody wychodzi do najtanszej wolnej sasiedniej komorki
+        float best = FLOW_UNREACHABLE;
+        for (int d = 0; d < 8; ++d) {
+            int n = flowNeighbour(flow, cell, d);
+            if (n >= 0 && flow.blockers[n] == 0 && flow.cost[n] < best) {
+                best = flow.cost[n];
+                target = n;
+            }
+        }
+    }
+    if (target < 0) return -1;
+
+    for (int step = 1, ahead = flow.next[target]; step < FLOW_LOOKAHEAD && ahead >= 0; ++step) {
+        if (!flowCellSeesCell(flow, cell, ahead))
+            break;
+        target = ahead;
+        ahead = flow.next[ahead];
+    }
+    return target;
+}
+
+// Cele licza sie tylko w zacienionych komorkach, bo tylko tam flowHeading ich uzywa; w ticku zostaje
+// jeden odczyt tablicy. Cel zalezy wylacznie od komorek odleglych o najwyzej FLOW_LOOKAHEAD (lancuch next
+// i odcinki do niego), wiec po naprawie wystarczy przeliczyc kwadrat wokol kazdej zmienionej komorki.
+void updateFlowAims(FlowField& flow, bool all)
+{
+    const int cells = FLOW_GRID * FLOW_GRID;
+    std::vector<std::uint8_t> marked(cells, all ? 1 : 0);
+
+    if (!all) {
+        const int R = FLOW_LOOKAHEAD + 1;
+        for (int source : flow.aimSources) {
+            int sx = source % FLOW_GRID;
+            int sz = source / FLOW_GRID;
+            for (int cz = std::max(0, sz - R); cz <= std::min(FLOW_GRID - 1, sz + R); ++cz)
+                std::fill(marked.begin() + cz * FLOW_GRID + std::max(0, sx - R),
+                    marked.begin() + cz * FLOW_GRID + std::min(FLOW_GRID - 1, sx + R) + 1, 1);
+        }
+        for (int cell : flow.aimCells)
+            marked[cell] = 1;
+    }
+
+    for (int cell = 0; cell < cells; ++cell) {
+        if (marked[cell])
+            flow.aim[cell] = flow.shadows[cell] != 0 ? flowAimFrom(flow, cell) : -1;
+    }
+    flow.aimSources.clear();
+    flow.aimCells.clear();
+}
+
+void buildFlowField(World& world)
+{
+    FlowField& flow = world.flow;
+    const int cells = FLOW_GRID * FLOW_GRID;
+
+    flow.cost.assign(cells, FLOW_UNREACHABLE);
+    flow.next.assign(cells, -1);
+    flow.blockers.assign(cells, 0);
+    flow.shadows.assign(cells, 0);
+    flow.aim.assign(cells, -1);
+    flow.dirty.clear();
+    flow.newlyBlocked.clear();
+    flow.aimSources.clear();
+    flow.aimCells.clear();
+    flow.built = true;
+
+    for (const auto& o : world.obstacles)
+        flowObstacleChanged(flow, o, +1);
+    flow.dirty.clear();
+    flow.newlyBlocked.clear();
+
+    FlowQueue queue;
+    for (int cell = 0; cell < cells; ++cell) {
+        if (flow.blockers[cell] == 0 && isNestCell(cell)) {
+            flow.cost[cell] = 0.0f;
+            queue.push({ 0.0f, cell });
+        }
+    }
+    flow.lastRepairCells = flowRelax(flow, queue);
+    updateFlowAims(flow, true);
+}
+
+// Naprawia pole po wszystkich zmianach zebranych przez flowObstacleChanged.
+void repairFlowField(FlowField& flow)
+{
+    if (!flow.built || (flow.dirty.empty() && flow.newlyBlocked.empty() && flow.aimCells.empty()))
+        return;
+
+    // 1) Nowo zablokowane komorki uniewazniaja wszystkie komorki, ktorych droga przez nie prowadzila
+    //    (rowniez te, ktore scinaly przez nie rog po przekatnej).
+    std::vector<int> invalid;
+    for (int cell : flow.newlyBlocked) {
+        for (int d = 4; d < 8; ++d) {
+            int cx = cell % FLOW_GRID + FLOW_DX[d];
+            int cz = cell / FLOW_GRID + FLOW_DZ[d];
+            if (cx < 0 || cx >= FLOW_GRID || cz < 0 || cz >= FLOW_GRID) continue;
+
+            // przekatna miedzy (cx, cell.z) i (cell.x, cz) ma zablokowana komorke z boku
+            int a = (cell / FLOW_GRID) * FLOW_GRID + cx;
+            int b = cz * FLOW_GRID + cell % FLOW_GRID;
+            if (flow.next[a] == b || flow.next[b] == a) {
+                int from = flow.next[a] == b ? a : b;
+                flow.cost[from] = FLOW_UNREACHABLE;
+                flow.next[from] = -1;
+                invalid.push_back(from);
+            }
+        }
+
+        if (flow.cost[cell] >= FLOW_UNREACHABLE) continue;
+        flow.cost[cell] = FLOW_UNREACHABLE;
+        flow.next[cell] = -1;
+        invalid.push_back(cell);
+    }
+    for (std::size_t k = 0; k < invalid.size(); ++k) {
+        int cell = invalid[k];
+        for (int d = 0; d < 8; ++d) {
+            int cx = cell % FLOW_GRID + FLOW_DX[d];
+            int cz = cell / FLOW_GRID + FLOW_DZ[d];
+            if (cx < 0 || cx >= FLOW_GRID || cz < 0 || cz >= FLOW_GRID) continue;
+
+            int n = cz * FLOW_GRID + cx;
+            if (flow.next[n] != cell) continue;
+            flow.cost[n] = FLOW_UNREACHABLE;
+            flow.next[n] = -1;
+            invalid.push_back(n);
+        }
+    }
+    invalid.insert(invalid.end(), flow.dirty.begin(), flow.dirty.end());
+    flow.aimSources.insert(flow.aimSources.end(), invalid.begin(), invalid.end());
+
+    // 2) Zwolnione komorki gniazda sa zrodlami; reszta startuje od waznych sasiadow zmienionego obszaru.
+    FlowQueue queue;
+    for (int cell : invalid) {
+        if (flow.blockers[cell] != 0) continue;
+
+        if (isNestCell(cell)) {
+            flow.cost[cell] = 0.0f;
+            flow.next[cell] = -1;
+            queue.push({ 0.0f, cell });
+        }
+
+        for (int d = 0; d < 8; ++d) {
+            int n = flowNeighbour(flow, cell, d);
+            if (n >= 0 && flow.blockers[n] == 0 && flow.cost[n] < FLOW_UNREACHABLE)
+                queue.push({ flow.cost[n], n });
+        }
+    }
+
+    flow.lastRepairCells = flowRelax(flow, queue);
+    flow.dirty.clear();
+    flow.newlyBlocked.clear();
+    updateFlowAims(flow, false);
+}
+
+// Kierunek powrotu do gniazda. Zmienia (dirX, dirZ) tylko wtedy, gdy prosta droga jest zaslonieta.
+void flowHeading(const FlowField& flow, float x, float z, float& dirX, float& dirZ)
+{
+    if (!flow.built) return;
+
+    int cell = flowCellAt(x, z);
+    if (flow.shadows[cell] == 0 || flow.aim[cell] < 0) return;
+
+    float tx, tz;
+    flowCellCenter(flow.aim[cell], tx, tz);
+    float dx = tx - x;
+    float dz = tz - z;
+    float len = std::sqrt(dx * dx + dz * dz);
+    if (len > 0.001f) {
+        dirX = dx / len;
+        dirZ = dz / len;
+    }
+}
+
+// dropLastObstacle i placeRandomObstacle tylko zapisuja zmiane w polu kierunkow; naprawe
+// (i wybudzenie leniwych mrowek) wolajacy robi raz, po calej partii zmian.
+bool dropLastObstacle(World& world)
+{
+    if (world.obstacles.empty())
+        return false;
+
+    flowObstacleChanged(world.flow, world.obstacles.back(), -1);
+    world.obstacles.pop_back();
+    return true;
+}
+
+bool placeRandomObstacle(World& world)
+{
+    if (world.obstacles.size() >= MAX_OBSTACLES)
+        return false;
+
+    Obstacle o;
+    o.size = 6.0f;
+
+    float HALF_SIZE = 50.0f - o.size;
+
+    float rx = (worldRand(world) % 1000) / 1000.0f;
+    float rz = (worldRand(world) % 1000) / 1000.0f;
+
+    o.x = -HALF_SIZE + 2.0f * HALF_SIZE * rx;
+    o.z = -HALF_SIZE + 2.0f * HALF_SIZE * rz;
+
+    float groundY = getGroundHeightAt(o.x, o.z);
+    o.y = groundY + o.size * 0.5f;
+
+    world.obstacles.push_back(o);
+
+    flowObstacleChanged(world.flow, o, +1);
+    return true;
+}
+
+void addRandomObstacle(World& world)
+{
+    wakeAllLazyAnts(world);
+    if (placeRandomObstacle(world))
+        repairFlowField(world.flow);
+}
+
+void drawAnthill()
+{
+    if (!g_quadric) return;
+
+    glPushMatrix();
+    glTranslatef(0.0f, 0.0f, 0.0f);
+
+    glRotatef(-90.0f, 1.0f, 0.0f, 0.0f);
+
+    float baseRadius = ANTHILL_BASE_RADIUS;
+    float topRadius = ANTHILL_TOP_RADIUS;
+    float height = ANTHILL_HEIGHT;
+    float holeRadius = ANTHILL_HOLE_RADIUS;
+
+    glColor3f(0.5f, 0.35f, 0.2f);
+    gluDisk(g_quadric, 0.0, baseRadius, 32, 1);
+
+    gluCylinder(g_quadric, baseRadius, topRadius, height, 32, 16);
+
+    glPushMatrix();
+    glTranslatef(0.0f, 0.0f, height);
+
+    glColor3f(0.45f, 0.30f, 0.18f);
+    gluDisk(g_quadric, holeRadius, topRadius, 32, 1);
+    glPopMatrix();
+
+    glPushMatrix();
+    glTranslatef(0.0f, 0.0f, height - 0.05f);
+    glColor3f(0.08f, 0.05f, 0.02f);
+    gluDisk(g_quadric, 0.0, holeRadius * 0.9f, 16, 1);
+    glPopMatrix();
+
+    glPopMatrix();
+}
+
+void getGroundNormalAt(float x, float z, float& nx, float& ny, float& nz)
+{
+    if (g_terrain.loaded && x * x + z * z >= ANTHILL_BASE_RADIUS * ANTHILL_BASE_RADIUS) {
+        terrainNormal(g_terrain, x, z, nx, ny, nz);
+        return;
+    }
+
+    const float eps = 0.1f;
+
+    float hL = getGroundHeightAt(x - eps, z);
+    float hR = getGroundHeightAt(x + eps, z);
+    float hD = getGroundHeightAt(x, z - eps);
+    float hU = getGroundHeightAt(x, z + eps);
+
+    float vx_x = 2.0f * eps;
+    float vx_y = hR - hL;
+    float vx_z = 0.0f;
+
+    float vz_x = 0.0f;
+    float vz_y = hU - hD;
+    float vz_z = 2.0f * eps;
+
+    nx = vx_y * vz_z - vx_z * vz_y;
+    ny = vx_z * vz_x - vx_x * vz_z;
+    nz = vx_x * vz_y - vx_y * vz_x;
+
+    float len = std::sqrt(nx * nx + ny * ny + nz * nz);
+    if (len > 0.0001f) {
+        nx /= len;
+        ny /= len;
+        nz /= len;
+    }
+    else {
+        nx = 0.0f;
+        ny = 1.0f;
+        nz = 0.0f;
+    }
+}
+
+void drawAnt(const Ant& ant)
 {
     if (!g_quadric) return;
 
-    glPushMatrix();
-    glTranslatef(0.0f, 0.0f, 0.0f);
+    float nx, ny, nz;
+    getGroundNormalAt(ant.x, ant.z, nx, ny, nz);
+    float ux = nx, uy = ny, uz = nz;
+
+    float fx = ant.dirX;
+    float fy = 0.0f;
+    float fz = ant.dirZ;
+
+    float flen = std::sqrt(fx * fx + fy * fy + fz * fz);
+    if (flen < 0.0001f) {
+        fx = 0.0f; fy = 0.0f; fz = 1.0f;
+        flen = 1.0f;
+    }
+    else {
+        fx /= flen;
+        fy /= flen;
+        fz /= flen;
+    }
+
+    float dotFN = fx * ux + fy * uy + fz * uz;
+    fx = fx - dotFN * ux;
+    fy = fy - dotFN * uy;
+    fz = fz - dotFN * uz;
+
+    flen = std::sqrt(fx * fx + fy * fy + fz * fz);
+    if (flen < 0.0001f) {
+        if (std::fabs(ux) < 0.9f)
+        {
+            fx = uz;
+            fy = 0.0f;
+            fz = -ux;
+        }
+        else
+        {
+            fx = 0.0f;
+            fy = uz;
+            fz = -uy;
+        }
+        flen = std::sqrt(fx * fx + fy * fy + fz * fz);
+    }
+    fx /= flen;
+    fy /= flen;
+    fz /= flen;
+
+    float rx = uy * fz - uz * fy;
+    float ry = uz * fx - ux * fz;
+    float rz = ux * fy - uy * fx;
+
+    float rlen = std::sqrt(rx * rx + ry * ry + rz * rz);
+    if (rlen > 0.0001f) {
+        rx /= rlen;
+        ry /= rlen;
+        rz /= rlen;
+    }
+
+    float m[16] = {
+        rx, ry, rz, 0.0f,
+        ux, uy, uz, 0.0f,
+        fx, fy, fz, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    };
+
+    glPushMatrix();
+    glTranslatef(ant.x, antHeightAt(ant.x, ant.z), ant.z);
+    glMultMatrixf(m);
+    glScalef(0.3f, 0.3f, 0.5f);
+
+    glColor3f(0.1f, 0.1f, 0.1f);
+
+    gluSphere(g_quadric, 0.5, 16, 16);
+
+    glTranslatef(0.0f, 0.0f, 0.8f);
+    gluSphere(g_quadric, 0.4, 16, 16);
+
+    glTranslatef(0.0f, 0.0f, 0.7f);
+    gluSphere(g_quadric, 0.35, 16, 16);
+    glPopMatrix();
+}
+
+// krotsze drzemki kosztuja wiecej (przeglad uspionych przy usypianiu) niz oszczedzaja
+const std::uint64_t LAZY_MIN_TICKS = 10;
+
+float steerHome(const World& world, Ant& a);
+bool avoidObstacles(const World& world, Ant& a, float dt);
+void moveAnt(Ant& a, float speed, float dt);
+
+// Przyblizona pozycja uspionej mrowki (po prostej do gniazda); wystarcza do rysowania, eksportu i histogramu.
+void lazyPosition(const World& world, const Ant& a, float& x, float& z)
+{
+    const LazyPath& path = world.lazyPaths[a.lazySlot];
+    // uspiona w biezacym ticku stoi jeszcze w pozycji startowej
+    std::uint64_t ticks = world.tick > path.startTick ? world.tick - path.startTick : 0;
+    float travelled = world.params.antSpeed * world.lazyDt * static_cast<float>(ticks);
+
+    x = a.x + path.dirX * travelled;
+    z = a.z + path.dirZ * travelled;
+}
+
+Ant lazyAntPreview(const World& world, const Ant& a)
+{
+    if (a.lazySlot < 0)
+        return a;
+
+    Ant m = a;
+    lazyPosition(world, a, m.x, m.z);
+    m.dirX = world.lazyPaths[a.lazySlot].dirX;
+    m.dirZ = world.lazyPaths[a.lazySlot].dirZ;
+    m.lazySlot = -1;
+    return m;
+}
+
+// Dokladny stan mrowki w biezacym ticku: powtarza przespane kroki tak, jak zrobilby je updateAnts
+// (odpychanie pomijamy, bo w czasie snu nikt nie podchodzi blizej niz AVOID_RADIUS).
+Ant materializedAnt(const World& world, const Ant& a)
+{
+    if (a.lazySlot < 0)
+        return a;
+
+    Ant m = a;
+    m.lazySlot = -1;
+    for (std::uint64_t t = world.lazyPaths[a.lazySlot].startTick; t < world.tick; ++t) {
+        steerHome(world, m);
+        avoidObstacles(world, m, world.lazyDt);
+        moveAnt(m, world.params.antSpeed, world.lazyDt);
+    }
+    return m;
+}
+
+void wakeAnt(World& world, Ant& a)
+{
+    if (a.lazySlot < 0)
+        return;
+
+    int slot = a.lazySlot;
+    a = materializedAnt(world, a);
+
+    world.lazyPaths[slot].generation++;
+    world.freeLazySlots.push_back(slot);
+    world.lazyCount--;
+
+    densityTrack(world, a);
+}
+
+// Wolane przed kazda zmiana, ktorej przespane kroki nie moga zobaczyc: nowe mrowki, przeszkody, inny krok.
+void wakeAllLazyAnts(World& world)
+{
+    if (world.lazyCount == 0)
+        return;
+
+    for (auto& a : world.ants)
+        wakeAnt(world, a);
+}
+
+// Czy odcinek od (x, z) do gniazda omija wszystkie przeszkody (z marginesem unikania).
+bool pathToNestIsClear(const World& world, float x, float z, float margin)
+{
+    for (const auto& o : world.obstacles) {
+        if (obstacleBlocksNestPath(x, z, o, margin))
+            return false;
+    }
+    return true;
+}
+
+// Usypia mrowke po jej ruchu w biezacym ticku na podana liczbe tickow.
+void sleepAnt(World& world, std::size_t index, std::uint64_t ticks, float dt)
+{
+    Ant& a = world.ants[index];
+
+    int slot;
+    if (!world.freeLazySlots.empty()) {
+        slot = world.freeLazySlots.back();
+        world.freeLazySlots.pop_back();
+    }
+    else {
+        slot = static_cast<int>(world.lazyPaths.size());
+        world.lazyPaths.push_back(LazyPath());
+    }
+
+    float distToNest = std::sqrt(a.x * a.x + a.z * a.z);
+
+    LazyPath& path = world.lazyPaths[slot];
+    path.antIndex = index;
+    path.startTick = world.tick + 1;
+    path.wakeTick = path.startTick + ticks;
+    path.dirX = -a.x / distToNest;
+    path.dirZ = -a.z / distToNest;
+
+    a.lazySlot = static_cast<std::int16_t>(slot);
+    world.lazyCount++;
+    world.lazyDt = dt;
+    world.sleeperX.push_back(a.x);
+    world.sleeperZ.push_back(a.z);
+
+    world.lazyEvents.push({ path.wakeTick, slot, path.generation });
+}
+
+void fireLazyEvents(World& world)
+{
+    while (!world.lazyEvents.empty() && world.lazyEvents.top().tick <= world.tick) {
+        LazyEvent e = world.lazyEvents.top();
+        world.lazyEvents.pop();
+
+        const LazyPath& path = world.lazyPaths[e.slot];
+        if (path.generation != e.generation)
+            continue;
+
+        wakeAnt(world, world.ants[path.antIndex]);
+    }
+}
+
+// W trakcie ticku nikt nie jest budzony (tylko na jego poczatku), wiec pozycje uspionych mrowek
+// liczymy raz, a trySleepAnt przeglada tylko je zamiast calej tablicy mrowek.
+void cacheSleeperPositions(World& world)
+{
+    world.sleeperX.clear();
+    world.sleeperZ.clear();
+    if (world.lazyCount == 0)
+        return;
+
+    for (const auto& a : world.ants) {
+        if (a.lazySlot < 0) continue;
+
+        float x, z;
+        lazyPosition(world, a, x, z);
+        world.sleeperX.push_back(x);
+        world.sleeperZ.push_back(z);
+    }
+}
+
+void releaseLazyAnt(World& world, const Ant& a)
+{
+    if (a.lazySlot < 0)
+        return;
+
+    world.lazyPaths[a.lazySlot].generation++;
+    world.freeLazySlots.push_back(a.lazySlot);
+    world.lazyCount--;
+}
+
+void resetLazyAnts(World& world)
+{
+    world.lazyPaths.clear();
+    world.freeLazySlots.clear();
+    world.lazyEvents = decltype(world.lazyEvents)();
+    world.lazyCount = 0;
+}
+
+void refreshLazyDensity(World& world)
+{
+    if (world.lazyCount == 0)
+        return;
+
+    for (auto& a : world.ants) {
+        if (a.lazySlot < 0) continue;
+
+        Ant m = lazyAntPreview(world, a);
+        densityTrack(world, m);
+        a.densityCell = m.densityCell;
+    }
+}
+
+void drawAnts(const World& world)
+{
+    for (const auto& a : world.ants)
+        drawAnt(lazyAntPreview(world, a));
+
+    for (const auto& p : world.packed)
+        drawAnt(unpackAnt(p));
+}
+
+// ----------------- 1) LOGIKA KIERUNKU: SZUKANIE / NIESIENIE -----------------
+
+// Kierunek mrowki niosacej jedzenie; zwraca odleglosc od gniazda.
+float steerHome(const World& world, Ant& a)
+{
+    float dx = 0.0f - a.x;
+    float dz = 0.0f - a.z;
+    float dist = std::sqrt(dx * dx + dz * dz);
+    if (dist > 0.001f) {
+        a.dirX = dx / dist;
+        a.dirZ = dz / dist;
+
+        if (world.useFlowField)
+            flowHeading(world.flow, a.x, a.z, a.dirX, a.dirZ);
+    }
+    return dist;
+}
+
+void steerAnt(World& world, Ant& a, float dt, TickCounters& stats)
+{
+    const SimParams& params = world.params;
+    const float FOOD_DETECT_RADIUS2 = params.foodDetectRadius * params.foodDetectRadius;
+
+    if (a.carryingFood) {
+        float dist = steerHome(world, a);
+
+        if (dist < NEST_RADIUS) {
+            a.carryingFood = false;
+            stats.deliveries.fetch_add(1, std::memory_order_relaxed);
+
+            float angle = (worldRand(world) % 1000) / 1000.0f * 2.0f * 3.14159265f;
+            a.dirX = simCos(angle);
+            a.dirZ = simSin(angle);
+        }
+        return;
+    }
+
+    float p = params.reorientProbPerSec * dt;
+    float r = (worldRand(world) % 1000) / 1000.0f;
+
+    if (r < p) {
+        float angle = (worldRand(world) % 1000) / 1000.0f * 2.0f * 3.14159265f;
+        a.dirX = simCos(angle);
+        a.dirZ = simSin(angle);
+    }
+    else {
+        float randTurn = ((worldRand(world) % 2000) / 1000.0f - 1.0f);
+        float deltaAngle = randTurn * params.turnSpeed * dt;
+
+        float cosA = simCos(deltaAngle);
+        float sinA = simSin(deltaAngle);
+
+        float newDirX = a.dirX * cosA - a.dirZ * sinA;
+        float newDirZ = a.dirX * sinA + a.dirZ * cosA;
+
+        float len = std::sqrt(newDirX * newDirX + newDirZ * newDirZ);
+        if (len > 0.0001f) {
+            a.dirX = newDirX / len;
+            a.dirZ = newDirZ / len;
+        }
+    }
+
+    std::vector<Food>& foods = world.foods;
+
+    int   bestIndex = -1;
+    float bestDist2 = FOOD_DETECT_RADIUS2;
+
+    for (std::size_t fi = 0; fi < foods.size(); ++fi) {
+        if (foods[fi].amount <= 0) continue;
+
+        float dx = foods[fi].x - a.x;
+        float dz = foods[fi].z - a.z;
+        float dist2 = dx * dx + dz * dz;
+
+        if (dist2 < bestDist2) {
+            bestDist2 = dist2;
+            bestIndex = (int)fi;
+        }
+    }
+
+    if (bestIndex >= 0) {
+        float dx = foods[bestIndex].x - a.x;
+        float dz = foods[bestIndex].z - a.z;
+        float dist = std::sqrt(dx * dx + dz * dz);
+        if (dist > 0.001f) {
+            a.dirX = dx / dist;
+            a.dirZ = dz / dist;
+        }
+
+        if (dist < FOOD_PICK_RADIUS && foods[bestIndex].amount > 0) {
+            foods[bestIndex].amount--;
+
+            a.carryingFood = true;
+            stats.pickups.fetch_add(1, std::memory_order_relaxed);
+
+            if (foods[bestIndex].amount <= 0) {
+                foods.erase(foods.begin() + bestIndex);
+            }
+        }
+    }
+}
+
+// ----------------- 2) UNIKANIE INNYCH MRÓWEK -----------------
+
+// Dodaje odpychanie od sasiada w (bx, bz); zwraca kwadrat odleglosci do niego
+// (sasiad jest w zasiegu, gdy jest mniejszy niz AVOID_RADIUS2).
+float accumulateSeparation(const Ant& a, float bx, float bz, float& sepX, float& sepZ)
+{
+    float dx = a.x - bx;
+    float dz = a.z - bz;
+    float dist2 = dx * dx + dz * dz;
+
+    if (dist2 > 0.0001f && dist2 < AVOID_RADIUS2) {
+        float dist = std::sqrt(dist2);
+        float w = (AVOID_RADIUS - dist) / AVOID_RADIUS;
+
+        sepX += (dx / dist) * w;
+        sepZ += (dz / dist) * w;
+    }
+
+    return dist2;
+}
+
+void applySeparation(Ant& a, float sepX, float sepZ, float weight, float dt)
+{
+    if (sepX != 0.0f || sepZ != 0.0f) {
+        float lenSep = std::sqrt(sepX * sepX + sepZ * sepZ);
+        if (lenSep > 0.0001f) {
+            sepX /= lenSep;
+            sepZ /= lenSep;
+
+            a.dirX += sepX * weight * dt;
+            a.dirZ += sepZ * weight * dt;
+        }
+    }
+}
+
+// ----------------- 3) UNIKANIE PRZESZKÓD -----------------
+
+// Zwraca true, jesli mrowka jest w zasiegu ktorejkolwiek przeszkody.
+bool avoidObstacles(const World& world, Ant& a, float dt)
+{
+    float obsAvoidX = 0.0f;
+    float obsAvoidZ = 0.0f;
+    bool nearObstacle = false;
+
+    for (const auto& o : world.obstacles) {
+        float dx = a.x - o.x;
+        float dz = a.z - o.z;
+
+        float obstacleRadius = std::sqrt(2.0f) * (o.size * 0.5f) + OBSTACLE_MARGIN;
+        float obstacleRadius2 = obstacleRadius * obstacleRadius;
+
+        float dist2 = dx * dx + dz * dz;
+        if (dist2 < obstacleRadius2)
+            nearObstacle = true;
+
+        if (dist2 < obstacleRadius2 && dist2 > 0.0001f) {
+            float dist = std::sqrt(dist2);
+            float w = (obstacleRadius - dist) / obstacleRadius;
+
+            obsAvoidX += (dx / dist) * w;
+            obsAvoidZ += (dz / dist) * w;
+        }
+    }
+
+    if (obsAvoidX != 0.0f || obsAvoidZ != 0.0f) {
+        float lenObs = std::sqrt(obsAvoidX * obsAvoidX + obsAvoidZ * obsAvoidZ);
+        if (lenObs > 0.0001f) {
+            obsAvoidX /= lenObs;
+            obsAvoidZ /= lenObs;
+
+            a.dirX += obsAvoidX * OBSTACLE_WEIGHT * dt;
+            a.dirZ += obsAvoidZ * OBSTACLE_WEIGHT * dt;
+        }
+    }
+
+    return nearObstacle;
+}
+
+// ----------------- 4) + 5) Normalizacja kierunku i ruch po XZ -----------------
+
+void moveAnt(Ant& a, float speed, float dt)
+{
+    float lenDir = std::sqrt(a.dirX * a.dirX + a.dirZ * a.dirZ);
+    if (lenDir > 0.0001f) {
+        a.dirX /= lenDir;
+        a.dirZ /= lenDir;
+    }
+
+    a.x += a.dirX * speed * dt;
+    a.z += a.dirZ * speed * dt;
+
+    if (a.x < -WORLD_HALF_SIZE) {
+        a.x = -WORLD_HALF_SIZE + BOUNCE_MARGIN;
+        a.dirX = -a.dirX;
+    }
+    else if (a.x > WORLD_HALF_SIZE) {
+        a.x = WORLD_HALF_SIZE - BOUNCE_MARGIN;
+        a.dirX = -a.dirX;
+    }
+
+    if (a.z < -WORLD_HALF_SIZE) {
+        a.z = -WORLD_HALF_SIZE + BOUNCE_MARGIN;
+        a.dirZ = -a.dirZ;
+    }
+    else if (a.z > WORLD_HALF_SIZE) {
+        a.z = WORLD_HALF_SIZE - BOUNCE_MARGIN;
+        a.dirZ = -a.dirZ;
+    }
+}
+
+// Ten sam krok co updateAnts, ale na tablicy PackedAnt (bez leniwych aktualizacji).
+void updateAntsPacked(World& world, float dt)
+{
+    applyWorldCommands(world);
+    if (world.useFlowField && !world.flow.built)
+        buildFlowField(world);
+
+    TickCounters& stats = localCounters(world);
+    std::vector<PackedAnt>& packed = world.packed;
+
+    for (std::size_t i = 0; i < packed.size(); ++i) {
+        Ant a = unpackAnt(packed[i]);
+
+        steerAnt(world, a, dt, stats);
+
+        float sepX = 0.0f;
+        float sepZ = 0.0f;
+        for (std::size_t j = 0; j < packed.size(); ++j) {
+            if (j == i) continue;
+            accumulateSeparation(a, fixedToFloat(packed[j].x), fixedToFloat(packed[j].z), sepX, sepZ);
+        }
+        applySeparation(a, sepX, sepZ, world.params.avoidWeight, dt);
+
+        avoidObstacles(world, a, dt);
+        moveAnt(a, world.params.antSpeed, dt);
+
+        // komorka liczona z pozycji po kwantyzacji, bo z niej unpackAnt odtworzy ja w nastepnym ticku
+        packed[i] = packAnt(a);
+        a.x = fixedToFloat(packed[i].x);
+        a.z = fixedToFloat(packed[i].z);
+        densityTrack(world, a);
+    }
+
+    world.simTime += dt;
+    world.tick++;
+}
+
+// Usypia mrowke i, jesli ma prosta, wolna droge do gniazda i zadna mrowka nie zdazy podejsc do niej
+// na AVOID_RADIUS przed koncem drzemki. nearest2 to kwadrat odleglosci do najblizszej nieuspionej mrowki.
+void trySleepAnt(World& world, std::size_t i, float dt, float nearest2)
+{
+    Ant& a = world.ants[i];
+
+    float step = world.params.antSpeed * dt;
+    float distToNest = std::sqrt(a.x * a.x + a.z * a.z);
+    if (step <= 0.0f || distToNest < NEST_RADIUS + LAZY_MIN_TICKS * step
+        || !pathToNestIsClear(world, a.x, a.z, OBSTACLE_MARGIN))
+        return;
+
+    // ponizej tej odleglosci sepTicks nie siegnie LAZY_MIN_TICKS (z zapasem na zaokraglenia),
+    // wiec dalsze szukanie najblizszej uspionej nic nie zmieni
+    float minGap = 0.99f * (AVOID_RADIUS + 2.0f * (BOUNCE_MARGIN + step) + 2.0f * step * (LAZY_MIN_TICKS + 1));
+    float minGap2 = minGap * minGap;
+    if (nearest2 < minGap2)
+        return;
+
+    for (std::size_t k = 0; k < world.sleeperX.size(); ++k) {
+        float dx = a.x - world.sleeperX[k];
+        float dz = a.z - world.sleeperZ[k];
+        float d2 = dx * dx + dz * dz;
+        if (d2 < minGap2)
+            return;
+        nearest2 = std::min(nearest2, d2);
+    }
+
+    // obie mrowki zblizaja sie najwyzej o 2 * step na tick; zapas na odbicie od krawedzi swiata
+    // i na sasiadow, ktorzy w tym ticku jeszcze sie nie ruszyli
+    float sepTicks = (std::sqrt(nearest2) - AVOID_RADIUS - 2.0f * (BOUNCE_MARGIN + step)) / (2.0f * step);
+    // budzi sie tick wczesniej, zeby jedzenie oddal juz w zwyklym kroku
+    float nestTicks = (distToNest - NEST_RADIUS) / step;
+    float ticks = std::min(sepTicks, nestTicks) - 1.0f;
+
+    if (ticks >= LAZY_MIN_TICKS)
+        sleepAnt(world, i, static_cast<std::uint64_t>(ticks), dt);
+}
+
+void updateAnts(World& world, float dt)
+{
+    if (dt <= 0.0f) return;
+
+    if (world.packedAnts) {
+        updateAntsPacked(world, dt);
+        return;
+    }
+
+    applyWorldCommands(world);
+    if (world.useFlowField && !world.flow.built)
+        buildFlowField(world);
+
+    TickCounters& stats = localCounters(world);
+
+    if (!world.lazyUpdates || dt != world.lazyDt)
+        wakeAllLazyAnts(world);
+    fireLazyEvents(world);
+    cacheSleeperPositions(world);
+
+    for (std::size_t i = 0; i < world.ants.size(); ++i) {
+        Ant& a = world.ants[i];
+
+        if (a.lazySlot >= 0) continue;
+
+        steerAnt(world, a, dt, stats);
+
+        float sepX = 0.0f;
+        float sepZ = 0.0f;
+        float nearest2 = FLOW_UNREACHABLE;
+
+        for (std::size_t j = 0; j < world.ants.size(); ++j) {
+            if (j == i) continue;
+            const Ant& b = world.ants[j];
+
+            // uspiona mrowka nie ma nikogo w zasiegu odpychania, wiec nic by nie dodala
+            if (b.lazySlot >= 0) continue;
+
+            nearest2 = std::min(nearest2, accumulateSeparation(a, b.x, b.z, sepX, sepZ));
+        }
+
+        applySeparation(a, sepX, sepZ, world.params.avoidWeight, dt);
+
+        bool nearObstacle = avoidObstacles(world, a, dt);
+
+        moveAnt(a, world.params.antSpeed, dt);
+
+        densityTrack(world, a);
+
+        // ----------------- 6) Usypianie mrowek na deterministycznej drodze -----------------
+
+        if (world.lazyUpdates && a.carryingFood && nearest2 >= AVOID_RADIUS2 && !nearObstacle)
+            trySleepAnt(world, i, dt, nearest2);
+    }
+
+    world.simTime += dt;
+    world.tick++;
+}
+
+// ----------------- PRZYSPIESZANIE CZASU: ROWNOLEGLE ODPYCHANIE -----------------
+
+// Pula watkow liczaca odpychanie mrowek. Watki czekaja na kolejne zadanie (generation) i biora
+// fragmenty tablicy z licznika nextChunk; watek wywolujacy pracuje razem z nimi.
+struct SeparationPool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable finished;
+    std::uint64_t generation = 0;
+    unsigned busy = 0;
+    bool stop = false;
+
+    std::function<void(unsigned)> job;
+    unsigned chunks = 0;
+    std::atomic<unsigned> nextChunk{ 0 };
+
+    // wyniki ostatniego ticku, po jednym wpisie na mrowke
+    std::vector<float> snapX, snapZ;
+    std::vector<float> sepX, sepZ;
+    std::vector<float> nearest2;
+
+    ~SeparationPool();
+};
+
+SeparationPool g_separationPool;
+
+const std::size_t PARALLEL_MIN_ANTS = 256;
+const std::size_t PARALLEL_CHUNK = 64;
+
+void runChunks(SeparationPool& pool)
+{
+    for (;;) {
+        unsigned c = pool.nextChunk.fetch_add(1, std::memory_order_relaxed);
+        if (c >= pool.chunks) break;
+        pool.job(c);
+    }
+}
+
+void separationWorker(SeparationPool& pool)
+{
+    std::uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            pool.start.wait(lock, [&]() { return pool.stop || pool.generation != seen; });
+            if (pool.stop) return;
+            seen = pool.generation;
+        }
+
+        runChunks(pool);
+
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (--pool.busy == 0)
+            pool.finished.notify_one();
+    }
+}
+
+SeparationPool::~SeparationPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    start.notify_all();
+    for (auto& t : workers)
+        t.join();
+}
+
+// Uruchamia job(0..chunks-1) na wszystkich rdzeniach i czeka na koniec.
+void runParallel(SeparationPool& pool, unsigned chunks, std::function<void(unsigned)> job)
+{
+    if (pool.workers.empty()) {
+        unsigned cores = std::thread::hardware_concurrency();
+        for (unsigned t = 1; t < cores; ++t)
+            pool.workers.emplace_back(separationWorker, std::ref(pool));
+    }
+
+    pool.job = std::move(job);
+    pool.chunks = chunks;
+    pool.nextChunk.store(0, std::memory_order_relaxed);
+
+    if (pool.workers.empty() || chunks < 2) {
+        runChunks(pool);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.busy = static_cast<unsigned>(pool.workers.size());
+        pool.generation++;
+    }
+    pool.start.notify_all();
+
+    runChunks(pool);
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.finished.wait(lock, [&]() { return pool.busy == 0; });
+}
+
+// Wersja updateAnts dla trybu przyspieszonego. Faza 1 liczy odpychanie wszystkich mrowek rownolegle
+// z pozycji na poczatku ticku (zamiast czesciowo juz przesunietych), faza 2 robi reszte kroku
+// sekwencyjnie, bo zuzywa liczby losowe i zmienia jedzenie. Wynik nie zalezy od liczby watkow,
+// ale rozni sie od updateAnts, wiec --verify traktuje go jako wariant przyblizony.
+void updateAntsParallel(World& world, float dt)
+{
+    if (dt <= 0.0f) return;
+
+    if (world.packedAnts) {
+        updateAntsPacked(world, dt);
+        return;
+    }
+
+    applyWorldCommands(world);
+    if (world.useFlowField && !world.flow.built)
+        buildFlowField(world);
+
+    TickCounters& stats = localCounters(world);
+
+    if (!world.lazyUpdates || dt != world.lazyDt)
+        wakeAllLazyAnts(world);
+    fireLazyEvents(world);
+    cacheSleeperPositions(world);
+
+    // ----------------- Faza 1: odpychanie od stanu z poczatku ticku -----------------
+
+    SeparationPool& pool = g_separationPool;
+    const std::size_t n = world.ants.size();
+
+    pool.snapX.resize(n);
+    pool.snapZ.resize(n);
+    pool.sepX.assign(n, 0.0f);
+    pool.sepZ.assign(n, 0.0f);
+    pool.nearest2.assign(n, FLOW_UNREACHABLE);
+
+    for (std::size_t i = 0; i < n; ++i) {
+        pool.snapX[i] = world.ants[i].x;
+        pool.snapZ[i] = world.ants[i].z;
+    }
+
+    unsigned chunks = static_cast<unsigned>((n + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK);
+
+    auto separationChunk = [&world, &pool, n](unsigned c) {
+        std::size_t begin = c * PARALLEL_CHUNK;
+        std::size_t end = std::min(n, begin + PARALLEL_CHUNK);
+
+        for (std::size_t i = begin; i < end; ++i) {
+            // uspione mrowki nie maja nikogo w zasiegu odpychania, ani one, ani nikt od nich
+            if (world.ants[i].lazySlot >= 0) continue;
+
+            Ant a;
+            a.x = pool.snapX[i];
+            a.z = pool.snapZ[i];
+
+            float sepX = 0.0f;
+            float sepZ = 0.0f;
+            float nearest2 = FLOW_UNREACHABLE;
+            for (std::size_t j = 0; j < n; ++j) {
+                if (j == i || world.ants[j].lazySlot >= 0) continue;
+                nearest2 = std::min(nearest2, accumulateSeparation(a, pool.snapX[j], pool.snapZ[j], sepX, sepZ));
+            }
+            pool.sepX[i] = sepX;
+            pool.sepZ[i] = sepZ;
+            pool.nearest2[i] = nearest2;
+        }
+    };
+
+    if (n >= PARALLEL_MIN_ANTS) {
+        runParallel(pool, chunks, separationChunk);
+    }
+    else {
+        for (unsigned c = 0; c < chunks; ++c)
+            separationChunk(c);
+    }
+
+    // ----------------- Faza 2: reszta kroku po kolei -----------------
+
+    for (std::size_t i = 0; i < n; ++i) {
+        Ant& a = world.ants[i];
+
+        if (a.lazySlot >= 0) continue;
+
+        steerAnt(world, a, dt, stats);
+        applySeparation(a, pool.sepX[i], pool.sepZ[i], world.params.avoidWeight, dt);
+
+        bool nearObstacle = avoidObstacles(world, a, dt);
+
+        moveAnt(a, world.params.antSpeed, dt);
+
+        densityTrack(world, a);
+
+        if (world.lazyUpdates && a.carryingFood && pool.nearest2[i] >= AVOID_RADIUS2 && !nearObstacle)
+            trySleepAnt(world, i, dt, pool.nearest2[i]);
+    }
+
+    world.simTime += dt;
+    world.tick++;
+}
+
+// ----------------- PRZYSPIESZANIE CZASU: WIELE TICKOW NA KLATKE -----------------
+
+// Predkosci wybierane klawiszem T; 0 = tyle tickow, ile zmiesci sie w budzecie klatki.
+const int WARP_SPEEDS[] = { 1, 10, 100, 0 };
+const int WARP_LEVELS = sizeof(WARP_SPEEDS) / sizeof(WARP_SPEEDS[0]);
+const float WARP_TICK = 1.0f / 60.0f;
+// czesc klatki 60 Hz zostawiona na rysowanie i obsluge zdarzen
+const double WARP_FRAME_BUDGET = 0.012;
+
+struct TimeWarp {
+    int level = 0;
+    double backlog = 0.0;
+};
+
+std::string warpLabel(const TimeWarp& warp)
+{
+    int speed = WARP_SPEEDS[warp.level];
+    return speed == 0 ? "max" : std::to_string(speed) + "x";
+}
+
+void cycleWarp(TimeWarp& warp)
+{
+    warp.level = (warp.level + 1) % WARP_LEVELS;
+    warp.backlog = 0.0;
+}
+
+// Przy 1x jeden krok o czas klatki, jak dotad, chyba ze wlaczone jest usypianie: uspione mrowki przezywaja
+// tylko ticki o tym samym dt, wiec wtedy 1x tez idzie tickami WARP_TICK. Przy przyspieszeniu stale ticki WARP_TICK,
+// dopoki nie nadrobia zadanej predkosci albo nie skonczy sie budzet klatki; rysowany jest tylko ostatni stan.
+// 10x i 100x licza ten sam model co 1x (updateAnts); tylko "max" uzywa odpychania rownoleglego, ktore
+// czyta pozycje sasiadow z poczatku ticku i daje nieco inne statystyki.
+void advanceSimulation(World& world, TimeWarp& warp, float frameDt)
+{
+    int speed = WARP_SPEEDS[warp.level];
+    if (speed == 1 && !world.lazyUpdates) {
+        updateAnts(world, frameDt);
+        return;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(WARP_FRAME_BUDGET);
+
+    if (speed == 0) {
+        do {
+            updateAntsParallel(world, WARP_TICK);
+        } while (std::chrono::steady_clock::now() < deadline);
+        return;
+    }
+
+    warp.backlog += static_cast<double>(frameDt) * speed;
+    while (warp.backlog >= WARP_TICK) {
+        updateAnts(world, WARP_TICK);
+        warp.backlog -= WARP_TICK;
+        if (std::chrono::steady_clock::now() >= deadline)
+            break;
+    }
+
+    // czego nie da sie nadrobic w tej klatce, przepada, zeby zaleglosci nie rosly bez konca
+    if (warp.backlog > WARP_TICK)
+        warp.backlog = 0.0;
+}
+
+std::size_t antCount(const World& world)
+{
+    return world.packedAnts ? world.packed.size() : world.ants.size();
+}
+
+// Kopia i-tej mrowki w biezacej chwili, niezaleznie od sposobu przechowywania.
+Ant antAt(const World& world, std::size_t i)
+{
+    if (world.packedAnts)
+        return unpackAnt(world.packed[i]);
+    return materializedAnt(world, world.ants[i]);
+}
+
+void addRandomAnt(World& world)
+{
+    if (antCount(world) >= MAX_ANTS)
+        return;
+
+    Ant a;
+
+    float radius = ANTHILL_TOP_RADIUS + 0.1f;
+    float angle = (worldRand(world) % 1000) / 1000.0f * 2.0f * 3.14159265f;
+
+    a.x = radius * simCos(angle);
+    a.z = radius * simSin(angle);
+
+    float dirAngle = (worldRand(world) % 1000) / 1000.0f * 2.0f * 3.14159265f;
+    a.dirX = simCos(dirAngle);
+    a.dirZ = simSin(dirAngle);
+    a.carryingFood = false;
+
+    if (world.packedAnts) {
+        a = unpackAnt(packAnt(a));
+        // unpackAnt ustawia densityCell na biezaca komorke, a ta mrowka nie jest jeszcze policzona
+        a.densityCell = -1;
+        densityTrack(world, a);
+        world.packed.push_back(packAnt(a));
+        return;
+    }
+
+    densityTrack(world, a);
+    world.ants.push_back(a);
+}
+
+
+void setCamera()
+{
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    float eyeX, eyeY, eyeZ;
+    cameraEye(eyeX, eyeY, eyeZ);
+
+    gluLookAt(
+        eyeX, eyeY, eyeZ,
+        0.0f, 1.0f, 0.0f,
+        0.0f, 1.0f, 0.0f
+    );
+}
+
+void resizeGL(int width, int height)
+{
+    if (height == 0) height = 1;
+    float aspect = static_cast<float>(width) / static_cast<float>(height);
+
+    glViewport(0, 0, width, height);
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(60.0, aspect, 0.1, 200.0);
+
+    glMatrixMode(GL_MODELVIEW);
+}
+
+
+void initOpenGL()
+{
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.5f, 0.8f, 1.0f, 1.0f);
+
+    setupLighting();
+
+    if (!loadGrassTexture("grass.png")) {
+        std::cerr << "Error przy ładowaniu tekstury\n";
+    }
+
+    g_quadric = gluNewQuadric();
+    if (g_quadric) {
+        gluQuadricNormals(g_quadric, GLU_SMOOTH);
+        gluQuadricTexture(g_quadric, GL_FALSE);
+    }
+
+    g_world.rng.seed(static_cast<unsigned>(time(nullptr)));
+}
+
+void addRandomFood(World& world)
+{
+    if (world.foods.size() >= MAX_FOOD_SOURCES)
+        return;
+
+    Food f;
+    f.amount = 20;
+    const float HALF_SIZE = 50.0f - 2.0f;
+    float rx = (worldRand(world) % 1000) / 1000.0f;
+    float rz = (worldRand(world) % 1000) / 1000.0f;
+
+    f.x = -HALF_SIZE + 2.0f * HALF_SIZE * rx;
+    f.z = -HALF_SIZE + 2.0f * HALF_SIZE * rz;
+
+    float groundY = getGroundHeightAt(f.x, f.z);
+    f.y = groundY + 0.5f;
+
+    world.foods.push_back(f);
+}
+
+void updateCameraFromKeyboard(float dt)
+{
+    const float angleSpeed = 60.0f;
+    const float zoomSpeed = 20.0f;
+
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left)) {
+        camAngleY -= angleSpeed * dt;
+    }
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Right)) {
+        camAngleY += angleSpeed * dt;
+    }
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Up)) {
+        camAngleX += angleSpeed * dt;
+        if (camAngleX > 89.0f) camAngleX = 89.0f;
+    }
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Down)) {
+        camAngleX -= angleSpeed * dt;
+        if (camAngleX < -10.0f) camAngleX = -10.0f;
+    }
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Z)) {
+        camDist -= zoomSpeed * dt;
+        if (camDist < 5.0f) camDist = 5.0f;
+    }
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::X)) {
+        camDist += zoomSpeed * dt;
+        if (camDist > 80.0f) camDist = 80.0f;
+    }
+}
+
+void showLegend() {
+    std::cout << "MOVE CAMERA           :   ARROWS\n";
+    std::cout << "ZOOM IN               :   Z\n";
+    std::cout << "ZOOM OUT              :   X\n\n";
 
-    glRotatef(-90.0f, 1.0f, 0.0f, 0.0f);
+    std::cout << "ADD OBSTACLE          :   O\n";
+    std::cout << "REMOVE OBSTACLE       :   P\n\n";
 
-    float baseRadius = ANTHILL_BASE_RADIUS;
-    float topRadius = ANTHILL_TOP_RADIUS;
-    float height = ANTHILL_HEIGHT;
-    float holeRadius = ANTHILL_HOLE_RADIUS;
+    std::cout << "ADD FOOD              :   F\n\n";
 
-    glColor3f(0.5f, 0.35f, 0.2f);
-    gluDisk(g_quadric, 0.0, baseRadius, 32, 1);
+    std::cout << "ADD ANT               :   A\n";
+    std::cout << "KILL AN ANT           :   K\n";
+    std::cout << "KILL ALL ANTS         :   Q\n\n";
 
-    gluCylinder(g_quadric, baseRadius, topRadius, height, 32, 16);
+    std::cout << "DENSITY HEATMAP       :   H\n";
+    std::cout << "LAZY UPDATES ON/OFF   :   L\n";
+    std::cout << "FLOW FIELD ON/OFF     :   G\n";
+    std::cout << "SPEED 1x/10x/100x/MAX :   T\n";
 
-    glPushMatrix();
-    glTranslatef(0.0f, 0.0f, height);
+}
 
-    glColor3f(0.45f, 0.30f, 0.18f);
-    gluDisk(g_quadric, holeRadius, topRadius, 32, 1);
-    glPopMatrix();
+void forgetAnt(World& world, const Ant& a)
+{
+    releaseLazyAnt(world, a);
+    densityForget(world, a);
+    if (a.carryingFood)
+        localCounters(world).lostLoads.fetch_add(1, std::memory_order_relaxed);
+}
 
-    glPushMatrix();
-    glTranslatef(0.0f, 0.0f, height - 0.05f);
-    glColor3f(0.08f, 0.05f, 0.02f);
-    gluDisk(g_quadric, 0.0, holeRadius * 0.9f, 16, 1);
-    glPopMatrix();
+void killAllAnts(World& world) {
+    for (const auto& a : world.ants)
+        forgetAnt(world, a);
+    world.ants.clear();
+    resetLazyAnts(world);
 
-    glPopMatrix();
+    for (const auto& p : world.packed)
+        forgetAnt(world, unpackAnt(p));
+    world.packed.clear();
 }
 
-void getGroundNormalAt(float x, float z, float& nx, float& ny, float& nz)
+void killAnt(World& world) {
+    if (!world.packed.empty()) {
+        forgetAnt(world, unpackAnt(world.packed.back()));
+        world.packed.pop_back();
+    }
+    else if (!world.ants.empty()) {
+        forgetAnt(world, world.ants.back());
+        world.ants.pop_back();
+    }
+}
+
+// Stosuje wszystkie zlecone polecenia jako jedna partie. Histogram gestosci jest poprawiany przy kazdej
+// mrowce (O(1)), a pole kierunkow raz na partie, a nie po kazdej przeszkodzie.
+std::size_t applyWorldCommands(World& world)
 {
-    const float eps = 0.1f;
+    std::size_t applied = 0;
+    bool obstaclesChanged = false;
+
+    WorldCommand c;
+    while (popCommand(world.commands, c)) {
+        // przespane kroki uspionych mrowek nie moga zobaczyc nowych mrowek ani przeszkod
+        if (c.type == WorldCommandType::SpawnAnts || c.type == WorldCommandType::AddObstacle
+            || c.type == WorldCommandType::RemoveObstacle)
+            wakeAllLazyAnts(world);
+
+        switch (c.type) {
+        case WorldCommandType::SpawnAnts:
+            for (int i = 0; i < c.count; ++i) addRandomAnt(world);
+            break;
+        case WorldCommandType::KillAnts:
+            for (int i = 0; i < c.count; ++i) killAnt(world);
+            break;
+        case WorldCommandType::KillAllAnts:
+            killAllAnts(world);
+            break;
+        case WorldCommandType::AddFood:
+            for (int i = 0; i < c.count; ++i) addRandomFood(world);
+            break;
+        case WorldCommandType::AddObstacle:
+            for (int i = 0; i < c.count; ++i) {
+                if (placeRandomObstacle(world))
+                    obstaclesChanged = true;
+            }
+            break;
+        case WorldCommandType::RemoveObstacle:
+            for (int i = 0; i < c.count; ++i) {
+                if (dropLastObstacle(world))
+                    obstaclesChanged = true;
+            }
+            break;
+        }
+        applied++;
+    }
 
-    float hL = getGroundHeightAt(x - eps, z);
-    float hR = getGroundHeightAt(x + eps, z);
-    float hD = getGroundHeightAt(x, z - eps);
-    float hU = getGroundHeightAt(x, z + eps);
+    if (obstaclesChanged)
+        repairFlowField(world.flow);
+    return applied;
+}
 
-    float vx_x = 2.0f * eps;
-    float vx_y = hR - hL;
-    float vx_z = 0.0f;
+// Wysokosci wierzcholkow mapy gestosci, ktora lezy na podlozu (teren, kopiec mrowiska) pociete na
+// DENSITY_OVERLAY_STEPS x DENSITY_OVERLAY_STEPS czworokatow na komorke. Wierzcholek dostaje maksimum
+// podloza w kwadracie o boku 2 * step wokol siebie: kazdy punkt czworokata lezy w kwadratach wszystkich
+// jego naroznikow, wiec interpolacja naroznikow nie schodzi pod podloze. Podloze sie nie zmienia,
+// wiec liczymy to raz (i od nowa, gdy zostanie wczytany teren).
+const std::vector<float>& densityOverlayHeights()
+{
+    static std::vector<float> heights;
+    static bool forTerrain = false;
+    if (!heights.empty() && forTerrain == g_terrain.loaded)
+        return heights;
+
+    const float lift = 0.05f;
+    const int n = DENSITY_GRID * DENSITY_OVERLAY_STEPS + 1;
+    const float step = DENSITY_CELL_SIZE / DENSITY_OVERLAY_STEPS;
+    const int samples = g_terrain.loaded ? static_cast<int>(std::ceil(step / g_terrain.header.cellSize)) : 4;
+
+    heights.assign(static_cast<std::size_t>(n) * n, 0.0f);
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            float x = -DENSITY_HALF_SIZE + i * step;
+            float z = -DENSITY_HALF_SIZE + j * step;
+            float top = getGroundHeightAt(x, z);
+            for (int b = -samples; b <= samples; ++b) {
+                for (int a = -samples; a <= samples; ++a)
+                    top = std::max(top, getGroundHeightAt(x + a * step / samples, z + b * step / samples));
+            }
+            heights[j * n + i] = top + lift;
+        }
+    }
+    forTerrain = g_terrain.loaded;
+    return heights;
+}
 
-    float vz_x = 0.0f;
-    float vz_y = hU - hD;
-    float vz_z = 2.0f * eps;
+void drawDensityOverlay(const World& world)
+{
+    if (!g_showDensity) return;
 
-    nx = vx_y * vz_z - vx_z * vz_y;
-    ny = vx_z * vz_x - vx_x * vz_z;
-    nz = vx_x * vz_y - vx_y * vz_x;
+    int maxCount = 0;
+    for (int c : world.density)
+        if (c > maxCount) maxCount = c;
+    if (maxCount == 0) return;
 
-    float len = std::sqrt(nx * nx + ny * ny + nz * nz);
-    if (len > 0.0001f) {
-        nx /= len;
-        ny /= len;
-        nz /= len;
+    glDisable(GL_LIGHTING);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+
+    const int n = DENSITY_GRID * DENSITY_OVERLAY_STEPS + 1;
+    const float step = DENSITY_CELL_SIZE / DENSITY_OVERLAY_STEPS;
+    const std::vector<float>& heights = densityOverlayHeights();
+
+    glBegin(GL_QUADS);
+    for (int cz = 0; cz < DENSITY_GRID; ++cz) {
+        for (int cx = 0; cx < DENSITY_GRID; ++cx) {
+            int count = world.density[cz * DENSITY_GRID + cx];
+            if (count == 0) continue;
+
+            float t = static_cast<float>(count) / maxCount;
+            glColor4f(1.0f, 1.0f - t, 0.0f, 0.25f + 0.5f * t);
+
+            for (int sz = 0; sz < DENSITY_OVERLAY_STEPS; ++sz) {
+                for (int sx = 0; sx < DENSITY_OVERLAY_STEPS; ++sx) {
+                    int i = cx * DENSITY_OVERLAY_STEPS + sx;
+                    int j = cz * DENSITY_OVERLAY_STEPS + sz;
+                    float x0 = -DENSITY_HALF_SIZE + i * step;
+                    float z0 = -DENSITY_HALF_SIZE + j * step;
+                    glVertex3f(x0, heights[j * n + i], z0);
+                    glVertex3f(x0, heights[(j + 1) * n + i], z0 + step);
+                    glVertex3f(x0 + step, heights[(j + 1) * n + i + 1], z0 + step);
+                    glVertex3f(x0 + step, heights[j * n + i + 1], z0);
+                }
+            }
+        }
+    }
+    glEnd();
+
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+    glEnable(GL_LIGHTING);
+}
+
+void openMetrics(MetricsReporter& m, const std::string& path)
+{
+    m.out.open(path, std::ios::out | std::ios::trunc);
+    if (!m.out) {
+        std::cerr << "Nie udalo sie otworzyc pliku metryk: " << path << std::endl;
+    }
+}
+
+// Wywolywane raz na klatke z czasem rzeczywistym; co METRICS_PERIOD zapisuje jedna linie JSON
+// i odswieza podsumowanie. Czasy i tempo dostaw w JSON sa w sekundach symulacji.
+bool updateMetrics(World& world, MetricsReporter& m, float dt)
+{
+    m.sinceReport += dt;
+    if (m.sinceReport < METRICS_PERIOD)
+        return false;
+
+    refreshLazyDensity(world);
+
+    CounterTotals t = sumCounters(world);
+    std::uint64_t carrying = t.pickups - t.deliveries - t.lostLoads;
+
+    float simElapsed = static_cast<float>(world.simTime - m.lastSimTime);
+    m.deliveriesPerSec = simElapsed > 0.0f ? (t.deliveries - m.lastDeliveries) / simElapsed : 0.0f;
+    m.simSpeed = simElapsed / m.sinceReport;
+    m.lastDeliveries = t.deliveries;
+    m.lastSimTime = world.simTime;
+    m.sinceReport = 0.0f;
+
+    std::ostringstream title;
+    title << "Anthill Simulation - ants: " << antCount(world)
+        << "  carrying: " << carrying
+        << "  delivered: " << t.deliveries
+        << "  food/s: " << m.deliveriesPerSec
+        << "  dormant: " << world.lazyCount
+        << "  sim s/s: " << m.simSpeed;
+    m.summary = title.str();
+
+    if (m.out) {
+        m.out << "{\"time\":" << world.simTime
+            << ",\"ants\":" << antCount(world)
+            << ",\"carrying\":" << carrying
+            << ",\"pickups\":" << t.pickups
+            << ",\"deliveries\":" << t.deliveries
+            << ",\"deliveries_per_sec\":" << m.deliveriesPerSec
+            << ",\"dormant\":" << world.lazyCount
+            << ",\"sim_speed\":" << m.simSpeed
+            << ",\"density_grid\":" << DENSITY_GRID
+            << ",\"density\":[";
+        for (int c = 0; c < DENSITY_GRID * DENSITY_GRID; ++c) {
+            if (c > 0) m.out << ',';
+            m.out << world.density[c];
+        }
+        m.out << "]}\n";
+        m.out.flush();
+    }
+
+    return true;
+}
+
+void drawScene(const World& world) {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    setCamera();
+    setupLighting();
+
+    drawFood(world);
+    if (g_terrain.loaded)
+        drawTerrain(g_terrain);
+    else
+        drawGround();
+    drawAnthill();
+    drawAnts(world);
+    drawObstacles(world);
+    drawDensityOverlay(world);
+}
+
+// ----------------- TRYB WSADOWY -----------------
+
+// Zakresy sa celowo szerokie; odrzucaja tylko wartosci bez sensu fizycznego (ujemne, nieskonczone,
+// szybsze niz przejscie calego swiata w kilka tickow).
+struct ParamField {
+    const char* name;
+    float SimParams::* field;
+    float minValue;
+    float maxValue;
+};
+
+const ParamField SWEEP_PARAMS[] = {
+    { "antSpeed", &SimParams::antSpeed, 0.0f, 50.0f },
+    { "turnSpeed", &SimParams::turnSpeed, 0.0f, 100.0f },
+    { "reorientProbPerSec", &SimParams::reorientProbPerSec, 0.0f, 60.0f },
+    { "foodDetectRadius", &SimParams::foodDetectRadius, 0.0f, 100.0f },
+    { "avoidWeight", &SimParams::avoidWeight, 0.0f, 100.0f },
+};
+
+const int SWEEP_PARAM_COUNT = sizeof(SWEEP_PARAMS) / sizeof(SWEEP_PARAMS[0]);
+
+const int PARAM_NOT_FOUND = -1;
+const int PARAM_INVALID = -2;
+
+// "antSpeed=2,3,4" -> indeks parametru i lista wartosci; PARAM_NOT_FOUND, jesli to nie jest parametr,
+// PARAM_INVALID (z komunikatem), jesli ktoras wartosc nie jest liczba albo wypada poza zakres parametru.
+int parseParamArg(const std::string& arg, std::vector<float>& values)
+{
+    std::size_t eq = arg.find('=');
+    if (eq == std::string::npos)
+        return -1;
+
+    std::string name = arg.substr(0, eq);
+    for (int p = 0; p < SWEEP_PARAM_COUNT; ++p) {
+        if (name != SWEEP_PARAMS[p].name) continue;
+
+        values.clear();
+        std::stringstream list(arg.substr(eq + 1));
+        std::string item;
+        while (std::getline(list, item, ',')) {
+            std::size_t used = 0;
+            try {
+                values.push_back(std::stof(item, &used));
+            }
+            catch (const std::exception&) {
+                used = 0;
+            }
+            if (used == 0 || used != item.size()) {
+                std::cerr << "Niepoprawna wartosc parametru " << name << ": " << item << std::endl;
+                return PARAM_INVALID;
+            }
+            // NaN nie przechodzi zadnego porownania, wiec odpada razem z nieskonczonosciami
+            if (!(values.back() >= SWEEP_PARAMS[p].minValue && values.back() <= SWEEP_PARAMS[p].maxValue)) {
+                std::cerr << "Wartosc parametru " << name << " poza zakresem [" << SWEEP_PARAMS[p].minValue
+                    << ", " << SWEEP_PARAMS[p].maxValue << "]: " << item << std::endl;
+                return PARAM_INVALID;
+            }
+        }
+        return p;
+    }
+    return PARAM_NOT_FOUND;
+}
+
+// Wartosc liczbowej opcji trybu wsadowego; caly tekst musi byc liczba z zakresu [minValue, maxValue].
+bool parseNumberOption(const std::string& option, const std::string& text, double minValue, double maxValue,
+    bool integer, double& out)
+{
+    std::size_t used = 0;
+    try {
+        out = std::stod(text, &used);
+    }
+    catch (const std::exception&) {
+        used = 0;
+    }
+
+    if (used == 0 || used != text.size() || !(out >= minValue && out <= maxValue)
+        || (integer && out != std::floor(out))) {
+        std::cerr << "Niepoprawna wartosc opcji " << option << ": " << text << " (oczekiwana ";
+        if (integer)
+            std::cerr << "liczba calkowita z zakresu [" << static_cast<long long>(minValue) << ", " << static_cast<long long>(maxValue) << "])";
+        else
+            std::cerr << "liczba z zakresu [" << minValue << ", " << maxValue << "])";
+        std::cerr << std::endl;
+        return false;
+    }
+    return true;
+}
+
+struct BatchConfig {
+    int runs = 10;
+    unsigned seed = 1;
+    float seconds = 300.0f;
+    float sampleEvery = 10.0f;
+    int antCount = 200;
+    int foodSources = 10;
+    int obstacleCount = 5;
+    unsigned threads = 0;
+    bool packed = false;
+    bool flowField = false;
+    std::string outPath = "results.csv";
+
+    std::vector<float> axes[SWEEP_PARAM_COUNT];
+};
+
+struct BatchJob {
+    SimParams params;
+    unsigned seed;
+};
+
+struct BatchSample {
+    float time;
+    std::uint64_t delivered;
+    std::uint64_t pickups;
+    std::uint64_t carrying;
+};
+
+void pinCurrentThread(unsigned core)
+{
+#ifdef _WIN32
+    SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << core);
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+void recordBatchSample(const World& world, std::vector<BatchSample>& samples)
+{
+    CounterTotals t = sumCounters(world);
+
+    BatchSample sample;
+    sample.time = static_cast<float>(world.simTime);
+    sample.delivered = t.deliveries;
+    sample.pickups = t.pickups;
+    sample.carrying = t.pickups - t.deliveries - t.lostLoads;
+    samples.push_back(sample);
+}
+
+void populateWorld(World& world, unsigned seed, int antCount, int obstacleCount)
+{
+    world.rng.seed(seed);
+
+    for (int i = 0; i < obstacleCount; ++i)
+        addRandomObstacle(world);
+    for (int i = 0; i < antCount; ++i)
+        addRandomAnt(world);
+}
+
+void topUpFood(World& world, int foodSources)
+{
+    if (foodSources > static_cast<int>(MAX_FOOD_SOURCES))
+        foodSources = static_cast<int>(MAX_FOOD_SOURCES);
+
+    while (world.foods.size() < static_cast<std::size_t>(foodSources))
+        addRandomFood(world);
+}
+
+// Jeden niezalezny przebieg: wlasny swiat, wlasny generator, wyniki tylko do wlasnego wektora.
+void runBatchJob(const BatchConfig& cfg, const BatchJob& job, std::vector<BatchSample>& samples)
+{
+    const float dt = 1.0f / 60.0f;
+
+    World world;
+    world.params = job.params;
+    world.packedAnts = cfg.packed;
+    world.useFlowField = cfg.flowField;
+    populateWorld(world, job.seed, cfg.antCount, cfg.obstacleCount);
+
+    long ticks = std::lround(cfg.seconds / dt);
+    long sampleTicks = std::lround(cfg.sampleEvery / dt);
+    if (sampleTicks < 1) sampleTicks = 1;
+
+    for (long tick = 0; tick < ticks; ++tick) {
+        topUpFood(world, cfg.foodSources);
+
+        updateAnts(world, dt);
+
+        if ((tick + 1) % sampleTicks == 0)
+            recordBatchSample(world, samples);
+    }
+}
+
+struct BatchNumberOption {
+    const char* name;
+    double minValue;
+    double maxValue;
+    bool integer;
+};
+
+const BatchNumberOption BATCH_NUMBER_OPTIONS[] = {
+    { "--runs", 1, 1000000, true },
+    { "--seed", 0, 4294967295.0, true },
+    { "--seconds", 0.001, 1e7, false },
+    { "--sample", 0.001, 1e7, false },
+    { "--ants", 0, MAX_ANTS, true },
+    { "--food", 0, static_cast<double>(MAX_FOOD_SOURCES), true },
+    { "--obstacles", 0, static_cast<double>(MAX_OBSTACLES), true },
+    { "--threads", 0, 1024, true },
+};
+
+int runBatch(int argc, char* argv[])
+{
+    BatchConfig cfg;
+
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        const BatchNumberOption* option = nullptr;
+        for (const auto& o : BATCH_NUMBER_OPTIONS) {
+            if (arg == o.name) option = &o;
+        }
+
+        std::vector<float> values;
+        int param = parseParamArg(arg, values);
+        if (param == PARAM_INVALID) {
+            return 1;
+        }
+        else if (param >= 0) {
+            cfg.axes[param] = values;
+        }
+        else if (arg == "--out" && hasValue) cfg.outPath = argv[++i];
+        else if (option && hasValue) {
+            double v = 0.0;
+            if (!parseNumberOption(arg, argv[++i], option->minValue, option->maxValue, option->integer, v))
+                return 1;
+
+            if (arg == "--runs") cfg.runs = static_cast<int>(v);
+            else if (arg == "--seed") cfg.seed = static_cast<unsigned>(v);
+            else if (arg == "--seconds") cfg.seconds = static_cast<float>(v);
+            else if (arg == "--sample") cfg.sampleEvery = static_cast<float>(v);
+            else if (arg == "--ants") cfg.antCount = static_cast<int>(v);
+            else if (arg == "--food") cfg.foodSources = static_cast<int>(v);
+            else if (arg == "--obstacles") cfg.obstacleCount = static_cast<int>(v);
+            else if (arg == "--threads") cfg.threads = static_cast<unsigned>(v);
+        }
+        else if (arg == "--packed") cfg.packed = true;
+        else if (arg == "--flow-field") cfg.flowField = true;
+        else {
+            std::cerr << "Nieznany argument trybu wsadowego: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    // iloczyn kartezjanski osi parametrow x kolejne ziarna
+    std::vector<BatchJob> jobs;
+    SimParams defaults;
+    std::vector<SimParams> grid(1, defaults);
+    for (int p = 0; p < SWEEP_PARAM_COUNT; ++p) {
+        if (cfg.axes[p].empty()) continue;
+
+        std::vector<SimParams> next;
+        for (const auto& base : grid) {
+            for (float v : cfg.axes[p]) {
+                SimParams sp = base;
+                sp.*(SWEEP_PARAMS[p].field) = v;
+                next.push_back(sp);
+            }
+        }
+        grid.swap(next);
+    }
+    for (const auto& sp : grid) {
+        for (int r = 0; r < cfg.runs; ++r) {
+            BatchJob job;
+            job.params = sp;
+            // kazda kombinacja parametrow dostaje te same ziarna, zeby dalo sie je porownac
+            job.seed = cfg.seed + static_cast<unsigned>(r);
+            jobs.push_back(job);
+        }
+    }
+
+    unsigned cores = std::thread::hardware_concurrency();
+    if (cores == 0) cores = 1;
+    unsigned threadCount = cfg.threads > 0 ? cfg.threads : cores;
+    if (threadCount > jobs.size()) threadCount = static_cast<unsigned>(jobs.size());
+
+    std::cout << "Batch: " << jobs.size() << " runs on " << threadCount << " threads\n";
+
+    std::vector<std::vector<BatchSample>> results(jobs.size());
+    std::atomic<std::size_t> nextJob{ 0 };
+    std::atomic<std::size_t> doneJobs{ 0 };
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threadCount; ++t) {
+        workers.emplace_back([&, t]() {
+            pinCurrentThread(t % cores);
+            for (;;) {
+                std::size_t j = nextJob.fetch_add(1, std::memory_order_relaxed);
+                if (j >= jobs.size()) break;
+
+                runBatchJob(cfg, jobs[j], results[j]);
+                doneJobs.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    while (doneJobs.load(std::memory_order_relaxed) < jobs.size()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        std::cout << "\r" << doneJobs.load(std::memory_order_relaxed) << " / " << jobs.size() << std::flush;
+    }
+    for (auto& w : workers)
+        w.join();
+
+    float wallSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "\nDone in " << wallSeconds << " s\n";
+
+    std::ofstream out(cfg.outPath, std::ios::out | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Nie udalo sie otworzyc pliku wynikow: " << cfg.outPath << std::endl;
+        return 1;
+    }
+
+    out << "run,seed";
+    for (int p = 0; p < SWEEP_PARAM_COUNT; ++p)
+        out << ',' << SWEEP_PARAMS[p].name;
+    out << ",time,delivered,pickups,carrying\n";
+
+    for (std::size_t j = 0; j < jobs.size(); ++j) {
+        for (const auto& sample : results[j]) {
+            out << j << ',' << jobs[j].seed;
+            for (int p = 0; p < SWEEP_PARAM_COUNT; ++p)
+                out << ',' << jobs[j].params.*(SWEEP_PARAMS[p].field);
+            out << ',' << sample.time << ',' << sample.delivered
+                << ',' << sample.pickups << ',' << sample.carrying << '\n';
+        }
+    }
+
+    return 0;
+}
+
+// ----------------- EKSPORT STANU I KANAL STERUJACY -----------------
+
+struct SimControl {
+    bool paused = false;
+    int pendingSteps = 0;
+};
+
+const float CONTROL_STEP_DT = 1.0f / 60.0f;
+// gorna granica n w spawn/kill/step; zaleglych krokow jest najwyzej tyle, a w klatce wykonuje sie
+// tylko tyle, ile zmiesci sie w WARP_FRAME_BUDGET, zeby okno nie zamarzalo
+const int CONTROL_MAX_COUNT = MAX_ANTS;
+// polecenie dluzsze niz CONTROL_MAX_LINE bez '\n' konczy polaczenie; w jednej klatce z jednego klienta
+// czytamy najwyzej CONTROL_MAX_READ bajtow, reszta czeka w gniezdzie do nastepnej
+const std::size_t CONTROL_MAX_LINE = 256;
+const std::size_t CONTROL_MAX_READ = 4096;
+
+struct SharedExport {
+    SharedMapping mapping;
+    std::uint64_t tick = 0;
+};
+
+bool openSharedExport(SharedExport& ex)
+{
+    if (!mapSharedState(ex.mapping, true)) {
+        std::cerr << "Nie udalo sie utworzyc pamieci wspoldzielonej " << SHARED_STATE_NAME << std::endl;
+        return false;
+    }
+
+    SharedState* state = ex.mapping.state;
+    std::memset(static_cast<void*>(state), 0, sizeof(SharedState));
+    state->header.magic = SHARED_STATE_MAGIC;
+    state->header.version = SHARED_STATE_VERSION;
+    state->header.maxAnts = SHARED_MAX_ANTS;
+    state->header.maxFoods = SHARED_MAX_FOODS;
+    state->header.maxObstacles = SHARED_MAX_OBSTACLES;
+    return true;
+}
+
+// Zapis do bufora, ktorego czytelnicy aktualnie nie uzywaja, potem przelaczenie front.
+void publishSharedState(SharedExport& ex, const World& world)
+{
+    SharedState* state = ex.mapping.state;
+    if (!state) return;
+
+    ex.tick++;
+
+    std::uint32_t back = 1 - state->header.front.load(std::memory_order_relaxed);
+    SharedBuffer& buf = state->buffers[back];
+
+    std::uint32_t seq = buf.seq.load(std::memory_order_relaxed);
+    buf.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::size_t antTotal = std::min<std::size_t>(antCount(world), SHARED_MAX_ANTS);
+    for (std::size_t i = 0; i < antTotal; ++i) {
+        // uspione mrowki w przyblizonej pozycji, zeby eksport nie powtarzal ich krokow co klatke
+        Ant a = world.packedAnts ? unpackAnt(world.packed[i]) : lazyAntPreview(world, world.ants[i]);
+        buf.antX[i] = a.x;
+        buf.antZ[i] = a.z;
+        buf.antDirX[i] = a.dirX;
+        buf.antDirZ[i] = a.dirZ;
+        buf.antCarrying[i] = a.carryingFood ? 1 : 0;
+    }
+    antHeightsAt(buf.antX, buf.antZ, buf.antY, antTotal);
+
+    std::size_t foodTotal = std::min<std::size_t>(world.foods.size(), SHARED_MAX_FOODS);
+    for (std::size_t i = 0; i < foodTotal; ++i) {
+        const Food& f = world.foods[i];
+        buf.foodX[i] = f.x;
+        buf.foodY[i] = f.y;
+        buf.foodZ[i] = f.z;
+        buf.foodAmount[i] = f.amount;
+    }
+
+    std::size_t obstacleTotal = std::min<std::size_t>(world.obstacles.size(), SHARED_MAX_OBSTACLES);
+    for (std::size_t i = 0; i < obstacleTotal; ++i) {
+        const Obstacle& o = world.obstacles[i];
+        buf.obstacleX[i] = o.x;
+        buf.obstacleY[i] = o.y;
+        buf.obstacleZ[i] = o.z;
+        buf.obstacleSize[i] = o.size;
+    }
+
+    buf.antCount = static_cast<std::uint32_t>(antTotal);
+    buf.foodCount = static_cast<std::uint32_t>(foodTotal);
+    buf.obstacleCount = static_cast<std::uint32_t>(obstacleTotal);
+    buf.tick = ex.tick;
+    buf.simTime = world.simTime;
+
+    buf.seq.store(seq + 2, std::memory_order_release);
+    state->header.front.store(back, std::memory_order_release);
+    state->header.published.fetch_add(1, std::memory_order_release);
+}
+
+void closeSharedExport(SharedExport& ex)
+{
+    unmapSharedState(ex.mapping);
+}
+
+struct ControlClient {
+    SocketHandle socket;
+    std::string pending;
+};
+
+struct ControlChannel {
+    SocketHandle listener = INVALID_SOCKET_HANDLE;
+    std::vector<ControlClient> clients;
+};
+
+// Czy na gniezdzie sterujacym w tym katalogu nasluchuje juz inna instancja symulacji. Plik gniazda
+// po zabitym procesie zostaje, ale polaczenie z nim sie nie udaje, wiec taki plik mozna usunac.
+bool controlSocketInUse()
+{
+    if (!initSockets())
+        return false;
+
+    SocketHandle probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe == INVALID_SOCKET_HANDLE)
+        return false;
+
+    sockaddr_un addr = controlSocketAddress();
+    bool inUse = connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    closeSocket(probe);
+    return inUse;
+}
+
+bool openControlChannel(ControlChannel& ch)
+{
+    if (!initSockets())
+        return false;
+
+    ch.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ch.listener == INVALID_SOCKET_HANDLE) {
+        std::cerr << "Nie udalo sie utworzyc gniazda sterujacego" << std::endl;
+        return false;
+    }
+
+    sockaddr_un addr = controlSocketAddress();
+    std::remove(CONTROL_SOCKET_PATH);
+
+    if (bind(ch.listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || listen(ch.listener, 4) != 0
+        || !setNonBlocking(ch.listener)) {
+        std::cerr << "Nie udalo sie nasluchiwac na " << CONTROL_SOCKET_PATH << std::endl;
+        closeSocket(ch.listener);
+        ch.listener = INVALID_SOCKET_HANDLE;
+        return false;
+    }
+
+    return true;
+}
+
+// spawn [n], kill [n], food, obstacle, pause, resume, step [n], status
+std::string applyControlCommand(World& world, SimControl& control, const std::string& line)
+{
+    std::istringstream in(line);
+    std::string cmd;
+    int n = 1;
+    in >> cmd >> n;
+    if (n < 1) n = 1;
+    if (n > CONTROL_MAX_COUNT) n = CONTROL_MAX_COUNT;
+
+    // zmiany swiata ida przez kolejke i wchodza w zycie na poczatku nastepnego ticku
+    bool queued = true;
+    if (cmd == "spawn") {
+        queued = submitCommand(world.commands, WorldCommandType::SpawnAnts, n);
+    }
+    else if (cmd == "kill") {
+        queued = submitCommand(world.commands, WorldCommandType::KillAnts, n);
+    }
+    else if (cmd == "food") {
+        queued = submitCommand(world.commands, WorldCommandType::AddFood);
+    }
+    else if (cmd == "obstacle") {
+        queued = submitCommand(world.commands, WorldCommandType::AddObstacle);
+    }
+    else if (cmd == "pause") {
+        control.paused = true;
+    }
+    else if (cmd == "resume") {
+        control.paused = false;
+    }
+    else if (cmd == "step") {
+        control.paused = true;
+        control.pendingSteps = std::min(control.pendingSteps + n, CONTROL_MAX_COUNT);
+    }
+    else if (cmd == "status") {
+        std::ostringstream status;
+        status << "ok time=" << world.simTime << " ants=" << antCount(world)
+            << " food=" << world.foods.size() << " obstacles=" << world.obstacles.size()
+            << " paused=" << (control.paused ? 1 : 0) << "\n";
+        return status.str();
     }
     else {
-        nx = 0.0f;
-        ny = 1.0f;
-        nz = 0.0f;
+        return "error unknown command\n";
     }
+
+    return queued ? "ok\n" : "error queue full\n";
 }
 
-void drawAnt(const Ant& ant)
+// Wywolywane raz na klatke; nigdy nie blokuje.
+void pollControlChannel(ControlChannel& ch, World& world, SimControl& control)
 {
-    if (!g_quadric) return;
-
-    float nx, ny, nz;
-    getGroundNormalAt(ant.x, ant.z, nx, ny, nz);
-    float ux = nx, uy = ny, uz = nz;
+    if (ch.listener == INVALID_SOCKET_HANDLE) return;
 
-    float fx = ant.dirX;
-    float fy = 0.0f;
-    float fz = ant.dirZ;
+    for (;;) {
+        SocketHandle client = accept(ch.listener, nullptr, nullptr);
+        if (client == INVALID_SOCKET_HANDLE) break;
 
-    float flen = std::sqrt(fx * fx + fy * fy + fz * fz);
-    if (flen < 0.0001f) {
-        fx = 0.0f; fy = 0.0f; fz = 1.0f;
-        flen = 1.0f;
-    }
-    else {
-        fx /= flen;
-        fy /= flen;
-        fz /= flen;
+        setNonBlocking(client);
+        ch.clients.push_back({ client, std::string() });
     }
 
-    float dotFN = fx * ux + fy * uy + fz * uz;
-    fx = fx - dotFN * ux;
-    fy = fy - dotFN * uy;
-    fz = fz - dotFN * uz;
-
-    flen = std::sqrt(fx * fx + fy * fy + fz * fz);
-    if (flen < 0.0001f) {
-        if (std::fabs(ux) < 0.9f)
-        {
-            fx = uz;
-            fy = 0.0f;
-            fz = -ux;
+    for (std::size_t c = 0; c < ch.clients.size();) {
+        ControlClient& client = ch.clients[c];
+        bool closed = false;
+
+        char buffer[512];
+        for (;;) {
+            int got = static_cast<int>(recv(client.socket, buffer, sizeof(buffer), 0));
+            if (got > 0) {
+                client.pending.append(buffer, got);
+                if (client.pending.size() >= CONTROL_MAX_READ)
+                    break;
+                continue;
+            }
+            if (got == 0 || !socketWouldBlock())
+                closed = true;
+            break;
         }
-        else
-        {
-            fx = 0.0f;
-            fy = uz;
-            fz = -uy;
+
+        std::size_t eol;
+        while ((eol = client.pending.find('\n')) != std::string::npos) {
+            std::string reply = applyControlCommand(world, control, client.pending.substr(0, eol));
+            client.pending.erase(0, eol + 1);
+            // klient, ktory juz sie rozlaczyl, nie dostaje odpowiedzi
+            if (!closed)
+                sendText(client.socket, reply);
         }
-        flen = std::sqrt(fx * fx + fy * fy + fz * fz);
-    }
-    fx /= flen;
-    fy /= flen;
-    fz /= flen;
 
-    float rx = uy * fz - uz * fy;
-    float ry = uz * fx - ux * fz;
-    float rz = ux * fy - uy * fx;
+        // zostal tylko niedokonczony wiersz; klient, ktory nie wysyla '\n', nie moze go rozdmuchac
+        bool tooLong = client.pending.size() > CONTROL_MAX_LINE;
+        if (tooLong && !closed)
+            sendText(client.socket, "error line too long\n");
 
-    float rlen = std::sqrt(rx * rx + ry * ry + rz * rz);
-    if (rlen > 0.0001f) {
-        rx /= rlen;
-        ry /= rlen;
-        rz /= rlen;
+        if (closed || tooLong) {
+            closeSocket(client.socket);
+            ch.clients.erase(ch.clients.begin() + c);
+        }
+        else {
+            ++c;
+        }
     }
-
-    float m[16] = {
-        rx, ry, rz, 0.0f,
-        ux, uy, uz, 0.0f,
-        fx, fy, fz, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f
-    };
-
-    glPushMatrix();
-    glTranslatef(ant.x, ant.y, ant.z);
-    glMultMatrixf(m);
-    glScalef(0.3f, 0.3f, 0.5f);
-
-    glColor3f(0.1f, 0.1f, 0.1f);
-
-    gluSphere(g_quadric, 0.5, 16, 16);
-
-    glTranslatef(0.0f, 0.0f, 0.8f);
-    gluSphere(g_quadric, 0.4, 16, 16);
-
-    glTranslatef(0.0f, 0.0f, 0.7f);
-    gluSphere(g_quadric, 0.35, 16, 16);
-    glPopMatrix();
 }
 
-void drawAnts()
+void closeControlChannel(ControlChannel& ch)
 {
-    for (const auto& a : ants) {
-        drawAnt(a);
+    for (auto& client : ch.clients)
+        closeSocket(client.socket);
+    ch.clients.clear();
+
+    if (ch.listener != INVALID_SOCKET_HANDLE) {
+        closeSocket(ch.listener);
+        ch.listener = INVALID_SOCKET_HANDLE;
+        std::remove(CONTROL_SOCKET_PATH);
     }
 }
 
-void updateAnts(float dt)
+// ----------------- HASZ STANU I WERYFIKACJA -----------------
+
+// Wzorcowa, celowo niezoptymalizowana wersja updateAnts (bez leniwych aktualizacji i metryk).
+// Sluzy tylko do porownan z wariantami zoptymalizowanymi w trybie --verify.
+void updateAntsReference(World& world, float dt)
 {
     if (dt <= 0.0f) return;
 
+    // pole kierunkow zmienia zachowanie, a nie tylko szybkosc, wiec referencja tez z niego korzysta
+    if (world.useFlowField && !world.flow.built)
+        buildFlowField(world);
+
     const float HALF_SIZE = 50.0f;
     const float BOUNCE_MARGIN = 1.0f;
 
-    const float REORIENT_PROB_PER_SEC = 0.5f;
-    const float TURN_SPEED = 4.0f;
+    const float REORIENT_PROB_PER_SEC = world.params.reorientProbPerSec;
+    const float TURN_SPEED = world.params.turnSpeed;
 
     const float AVOID_RADIUS = 2.0f;
     const float AVOID_RADIUS2 = AVOID_RADIUS * AVOID_RADIUS;
-    const float AVOID_WEIGHT = 5.0f;
+    const float AVOID_WEIGHT = world.params.avoidWeight;
 
     const float OBSTACLE_MARGIN = 1.5f;
     const float OBSTACLE_WEIGHT = 8.0f;
 
-    const float FOOD_DETECT_RADIUS = 8.0f;
+    const float FOOD_DETECT_RADIUS = world.params.foodDetectRadius;
     const float FOOD_DETECT_RADIUS2 = FOOD_DETECT_RADIUS * FOOD_DETECT_RADIUS;
     const float FOOD_PICK_RADIUS = 1.5f;
     const float NEST_RADIUS = ANTHILL_TOP_RADIUS + 1.0f;
+    const float ANT_SPEED = world.params.antSpeed;
 
-    for (std::size_t i = 0; i < ants.size(); ++i) {
-        Ant& a = ants[i];
+    for (std::size_t i = 0; i < world.ants.size(); ++i) {
+        Ant& a = world.ants[i];
 
         // ----------------- 1) LOGIKA KIERUNKU: SZUKANIE / NIESIENIE -----------------
 
@@ -465,31 +3893,34 @@ void updateAnts(float dt)
             if (dist > 0.001f) {
                 a.dirX = dx / dist;
                 a.dirZ = dz / dist;
+
+                if (world.useFlowField)
+                    flowHeading(world.flow, a.x, a.z, a.dirX, a.dirZ);
             }
 
             if (dist < NEST_RADIUS) {
                 a.carryingFood = false;
 
-                float angle = (std::rand() % 1000) / 1000.0f * 2.0f * 3.14159265f;
-                a.dirX = std::cos(angle);
-                a.dirZ = std::sin(angle);
+                float angle = (worldRand(world) % 1000) / 1000.0f * 2.0f * 3.14159265f;
+                a.dirX = simCos(angle);
+                a.dirZ = simSin(angle);
             }
         }
         else {
             float p = REORIENT_PROB_PER_SEC * dt;
-            float r = (std::rand() % 1000) / 1000.0f;
+            float r = (worldRand(world) % 1000) / 1000.0f;
 
             if (r < p) {
-                float angle = (std::rand() % 1000) / 1000.0f * 2.0f * 3.14159265f;
-                a.dirX = std::cos(angle);
-                a.dirZ = std::sin(angle);
+                float angle = (worldRand(world) % 1000) / 1000.0f * 2.0f * 3.14159265f;
+                a.dirX = simCos(angle);
+                a.dirZ = simSin(angle);
             }
             else {
-                float randTurn = ((std::rand() % 2000) / 1000.0f - 1.0f);
+                float randTurn = ((worldRand(world) % 2000) / 1000.0f - 1.0f);
                 float deltaAngle = randTurn * TURN_SPEED * dt;
 
-                float cosA = std::cos(deltaAngle);
-                float sinA = std::sin(deltaAngle);
+                float cosA = simCos(deltaAngle);
+                float sinA = simSin(deltaAngle);
 
                 float newDirX = a.dirX * cosA - a.dirZ * sinA;
                 float newDirZ = a.dirX * sinA + a.dirZ * cosA;
@@ -505,11 +3936,11 @@ void updateAnts(float dt)
             int   bestIndex = -1;
             float bestDist2 = FOOD_DETECT_RADIUS2;
 
-            for (std::size_t fi = 0; fi < foods.size(); ++fi) {
-                if (foods[fi].amount <= 0) continue;
+            for (std::size_t fi = 0; fi < world.foods.size(); ++fi) {
+                if (world.foods[fi].amount <= 0) continue;
 
-                float dx = foods[fi].x - a.x;
-                float dz = foods[fi].z - a.z;
+                float dx = world.foods[fi].x - a.x;
+                float dz = world.foods[fi].z - a.z;
                 float dist2 = dx * dx + dz * dz;
 
                 if (dist2 < bestDist2) {
@@ -519,21 +3950,21 @@ void updateAnts(float dt)
             }
 
             if (bestIndex >= 0) {
-                float dx = foods[bestIndex].x - a.x;
-                float dz = foods[bestIndex].z - a.z;
+                float dx = world.foods[bestIndex].x - a.x;
+                float dz = world.foods[bestIndex].z - a.z;
                 float dist = std::sqrt(dx * dx + dz * dz);
                 if (dist > 0.001f) {
                     a.dirX = dx / dist;
                     a.dirZ = dz / dist;
                 }
 
-                if (dist < FOOD_PICK_RADIUS && foods[bestIndex].amount > 0) {
-                    foods[bestIndex].amount--;
+                if (dist < FOOD_PICK_RADIUS && world.foods[bestIndex].amount > 0) {
+                    world.foods[bestIndex].amount--;
 
                     a.carryingFood = true;
 
-                    if (foods[bestIndex].amount <= 0) {
-                        foods.erase(foods.begin() + bestIndex);
+                    if (world.foods[bestIndex].amount <= 0) {
+                        world.foods.erase(world.foods.begin() + bestIndex);
                     }
                 }
             }
@@ -544,9 +3975,9 @@ void updateAnts(float dt)
         float sepX = 0.0f;
         float sepZ = 0.0f;
 
-        for (std::size_t j = 0; j < ants.size(); ++j) {
+        for (std::size_t j = 0; j < world.ants.size(); ++j) {
             if (j == i) continue;
-            const Ant& b = ants[j];
+            const Ant& b = world.ants[j];
 
             float dx = a.x - b.x;
             float dz = a.z - b.z;
@@ -577,7 +4008,7 @@ void updateAnts(float dt)
         float obsAvoidX = 0.0f;
         float obsAvoidZ = 0.0f;
 
-        for (const auto& o : obstacles) {
+        for (const auto& o : world.obstacles) {
             float dx = a.x - o.x;
             float dz = a.z - o.z;
 
@@ -636,184 +4067,494 @@ void updateAnts(float dt)
             a.dirZ = -a.dirZ;
         }
 
-
-        float groundY = getGroundHeightAt(a.x, a.z);
-        a.y = groundY + 0.1f;
     }
+
+    world.simTime += dt;
+    world.tick++;
 }
 
-void addRandomAnt()
+const std::uint64_t FNV_OFFSET = 1469598103934665603ull;
+const std::uint64_t FNV_PRIME = 1099511628211ull;
+
+void hashBytes(std::uint64_t& h, const void* data, std::size_t size)
 {
-    if (ants.size() >= MAX_ANTS)
-        return;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= FNV_PRIME;
+    }
+}
 
-    Ant a;
+void hashFloat(std::uint64_t& h, float v)
+{
+    if (v == 0.0f) v = 0.0f; // -0 i +0 daja ten sam hasz
+    std::uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    hashBytes(h, &bits, sizeof(bits));
+}
 
-    float radius = ANTHILL_TOP_RADIUS + 0.1f;
-    float angle = (std::rand() % 1000) / 1000.0f * 2.0f * 3.14159265f;
+void hashInt(std::uint64_t& h, std::int64_t v)
+{
+    hashBytes(h, &v, sizeof(v));
+}
 
-    a.x = radius * std::cos(angle);
-    a.z = radius * std::sin(angle);
+// Kanoniczny hasz mrowek, jedzenia i przeszkod. Uspione mrowki sa liczone w biezacej pozycji.
+std::uint64_t hashWorld(const World& world)
+{
+    std::uint64_t h = FNV_OFFSET;
+
+    std::size_t count = antCount(world);
+    hashInt(h, static_cast<std::int64_t>(count));
+    for (std::size_t i = 0; i < count; ++i) {
+        Ant a = antAt(world, i);
+        hashFloat(h, a.x);
+        hashFloat(h, a.z);
+        hashFloat(h, a.dirX);
+        hashFloat(h, a.dirZ);
+        hashInt(h, a.carryingFood ? 1 : 0);
+    }
 
-    float groundY = getGroundHeightAt(a.x, a.z);
-    a.y = groundY + 0.1f;
+    hashInt(h, static_cast<std::int64_t>(world.foods.size()));
+    for (const auto& f : world.foods) {
+        hashFloat(h, f.x);
+        hashFloat(h, f.z);
+        hashInt(h, f.amount);
+    }
 
-    float dirAngle = (std::rand() % 1000) / 1000.0f * 2.0f * 3.14159265f;
-    a.dirX = std::cos(dirAngle);
-    a.dirZ = std::sin(dirAngle);
-    a.carryingFood = false;
+    hashInt(h, static_cast<std::int64_t>(world.obstacles.size()));
+    for (const auto& o : world.obstacles) {
+        hashFloat(h, o.x);
+        hashFloat(h, o.z);
+        hashFloat(h, o.size);
+    }
 
-    ants.push_back(a);
+    return h;
 }
 
+struct VerifyScenario {
+    const char* name;
+    unsigned seed;
+    int antCount;
+    int foodSources;
+    int obstacleCount;
+    int ticks;
+};
 
-void setCamera()
-{
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+const VerifyScenario VERIFY_SCENARIOS[] = {
+    { "sparse", 11, 20, 5, 0, 3600 },
+    { "crowded", 12, 400, 10, 0, 1200 },
+    { "obstacles", 13, 150, 10, 20, 2400 },
+    { "food_rich", 14, 200, 20, 5, 2400 },
+};
 
-    float radY = camAngleY * 3.14159265f / 180.0f;
-    float radX = camAngleX * 3.14159265f / 180.0f;
+const int GOLDEN_HASH_EVERY = 60;
+const float VERIFY_DT = 1.0f / 60.0f;
+
+typedef void (*UpdateFn)(World& world, float dt);
+
+struct UpdateVariant {
+    const char* name;
+    UpdateFn update;
+    bool lazy;
+    bool packed;
+    bool flow;
+    // 0 = musi sie zgadzac bit w bit przez caly przebieg; inaczej dopuszczalny blad pozycji
+    // przez pierwsze boundTicks tickow (dalej mrowki rozchodza sie jak w kazdym ukladzie chaotycznym)
+    float tolerance;
+    int boundTicks;
+};
+
+// Granice wariantow przyblizonych maja zapas ok. 1.5x wzgledem zmierzonych rozbieznosci.
+const UpdateVariant UPDATE_VARIANTS[] = {
+    { "updateAnts", updateAnts, false, false, false, 0.0f, 0 },
+    { "updateAnts+lazy", updateAnts, true, false, false, 0.0f, 0 },
+    { "updateAnts+flow", updateAnts, false, false, true, 0.0f, 0 },
+    { "updateAnts+lazy+flow", updateAnts, true, false, true, 0.0f, 0 },
+    { "updateAnts+packed", updateAnts, false, true, true, 0.01f, 30 },
+    { "updateAntsParallel", updateAntsParallel, false, false, true, 0.1f, 5 },
+};
 
-    float eyeX = camDist * std::cos(radX) * std::sin(radY);
-    float eyeY = camDist * std::sin(radX);
-    float eyeZ = camDist * std::cos(radX) * std::cos(radY);
+const int UPDATE_VARIANT_COUNT = sizeof(UPDATE_VARIANTS) / sizeof(UPDATE_VARIANTS[0]);
 
-    const float minCameraHeight = 1.0f;
-    if (eyeY < minCameraHeight)
-        eyeY = minCameraHeight;
+// Najwieksza dopuszczalna roznica sumy podniesien i dostarczen jedzenia (ze wszystkich scenariuszy)
+// miedzy wariantem a referencja. Rozjechane przebiegi to niezalezne proby po kilkaset zdarzen,
+// wiec sam szum to ok. 7%; granica lapie dopiero zmiane zachowania.
+const float VERIFY_LOADS_TOLERANCE = 0.2f;
 
-    gluLookAt(
-        eyeX, eyeY, eyeZ,
-        0.0f, 1.0f, 0.0f,
-        0.0f, 1.0f, 0.0f
-    );
+void setupScenario(World& world, const VerifyScenario& sc, const UpdateVariant& variant)
+{
+    world.packedAnts = variant.packed;
+    world.lazyUpdates = variant.lazy;
+    world.useFlowField = variant.flow;
+    populateWorld(world, sc.seed, sc.antCount, sc.obstacleCount);
+    topUpFood(world, sc.foodSources);
 }
 
-void resizeGL(int width, int height)
+bool antsDiverge(const Ant& a, const Ant& b, float tolerance)
 {
-    if (height == 0) height = 1;
-    float aspect = static_cast<float>(width) / static_cast<float>(height);
+    if (a.carryingFood != b.carryingFood)
+        return true;
 
-    glViewport(0, 0, width, height);
-
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(60.0, aspect, 0.1, 200.0);
+    if (tolerance == 0.0f)
+        return a.x != b.x || a.z != b.z || a.dirX != b.dirX || a.dirZ != b.dirZ;
 
-    glMatrixMode(GL_MODELVIEW);
+    return std::fabs(a.x - b.x) > tolerance || std::fabs(a.z - b.z) > tolerance;
 }
 
+struct LoadTotals {
+    std::uint64_t pickups = 0;
+    std::uint64_t deliveries = 0;
+};
 
-void initOpenGL()
+// Referencja nie liczy metryk, wiec podniesienia i dostarczenia liczymy z przejsc carryingFood.
+void countLoads(const World& world, std::vector<std::uint8_t>& carrying, LoadTotals& totals)
 {
-    glEnable(GL_DEPTH_TEST);
-    glClearColor(0.5f, 0.8f, 1.0f, 1.0f);
+    std::size_t count = antCount(world);
+    carrying.resize(count, 0);
+    for (std::size_t i = 0; i < count; ++i) {
+        bool now = world.packedAnts ? (world.packed[i].flags & PACKED_CARRYING) != 0 : world.ants[i].carryingFood;
+        if (now && !carrying[i]) totals.pickups++;
+        if (!now && carrying[i]) totals.deliveries++;
+        carrying[i] = now ? 1 : 0;
+    }
+}
 
-    setupLighting();
+// Liczy referencje i wariant krok w krok i raportuje pierwsza rozbieznosc. Zwraca false, jesli
+// wariant wyszedl poza swoja granice; sumy podniesien i dostarczen dopisuje do refLoads i loads.
+bool compareWithReference(const VerifyScenario& sc, const UpdateVariant& variant, LoadTotals& refLoads, LoadTotals& loads)
+{
+    UpdateVariant reference = { "reference", updateAntsReference, false, false, variant.flow, 0.0f, 0 };
 
-    if (!loadGrassTexture("grass.png")) {
-        std::cerr << "Error przy ładowaniu tekstury\n";
-    }
+    World ref;
+    World opt;
+    setupScenario(ref, sc, reference);
+    setupScenario(opt, sc, variant);
 
-    g_quadric = gluNewQuadric();
-    if (g_quadric) {
-        gluQuadricNormals(g_quadric, GLU_SMOOTH);
-        gluQuadricTexture(g_quadric, GL_FALSE);
-    }
+    int bound = variant.tolerance == 0.0f ? sc.ticks : std::min(variant.boundTicks, sc.ticks);
+    std::vector<std::uint8_t> refCarrying;
+    std::vector<std::uint8_t> optCarrying;
+    bool diverged = false;
+    bool ok = true;
 
-    std::srand(static_cast<unsigned>(time(nullptr)));
-}
+    for (int tick = 0; tick < sc.ticks; ++tick) {
+        topUpFood(ref, sc.foodSources);
+        topUpFood(opt, sc.foodSources);
 
-void addRandomFood()
-{
-    if (foods.size() >= MAX_FOOD_SOURCES)
-        return;
+        updateAntsReference(ref, VERIFY_DT);
+        variant.update(opt, VERIFY_DT);
 
-    Food f;
-    f.amount = 20;
-    const float HALF_SIZE = 50.0f - 2.0f;
-    float rx = (std::rand() % 1000) / 1000.0f;
-    float rz = (std::rand() % 1000) / 1000.0f;
+        countLoads(ref, refCarrying, refLoads);
+        countLoads(opt, optCarrying, loads);
 
-    f.x = -HALF_SIZE + 2.0f * HALF_SIZE * rx;
-    f.z = -HALF_SIZE + 2.0f * HALF_SIZE * rz;
+        if (diverged)
+            continue;
 
-    float groundY = getGroundHeightAt(f.x, f.z);
-    f.y = groundY + 0.5f;
+        std::ostringstream where;
+        if (ref.ants.size() != antCount(opt) || ref.foods.size() != opt.foods.size()) {
+            where << " (ants " << ref.ants.size() << " vs " << antCount(opt)
+                << ", food " << ref.foods.size() << " vs " << opt.foods.size() << ")";
+            diverged = true;
+        }
+        for (std::size_t i = 0; !diverged && i < ref.ants.size(); ++i) {
+            Ant a = ref.ants[i];
+            Ant b = antAt(opt, i);
+            if (!antsDiverge(a, b, variant.tolerance)) continue;
+
+            where << ", ant " << i << " (ref x=" << a.x << " z=" << a.z << " carrying=" << a.carryingFood
+                << ", got x=" << b.x << " z=" << b.z << " carrying=" << b.carryingFood << ")";
+            diverged = true;
+        }
+
+        if (diverged) {
+            ok = tick >= bound;
+            std::cout << "  " << variant.name << ": diverged at tick " << tick << where.str()
+                << (ok ? "" : " - FAIL") << "\n";
+        }
+    }
 
-    foods.push_back(f);
+    if (!diverged)
+        std::cout << "  " << variant.name << ": matches reference for " << sc.ticks << " ticks\n";
+    return ok;
 }
 
-void updateCameraFromKeyboard(float dt)
+// Hasze co GOLDEN_HASH_EVERY tickow dla wariantu; ten sam przebieg co w compareWithReference.
+void goldenTrace(const VerifyScenario& sc, const UpdateVariant& variant, std::vector<std::uint64_t>& hashes)
 {
-    const float angleSpeed = 60.0f;
-    const float zoomSpeed = 20.0f;
+    World world;
+    setupScenario(world, sc, variant);
 
-    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left)) {
-        camAngleY -= angleSpeed * dt;
-    }
-    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Right)) {
-        camAngleY += angleSpeed * dt;
+    for (int tick = 1; tick <= sc.ticks; ++tick) {
+        topUpFood(world, sc.foodSources);
+        variant.update(world, VERIFY_DT);
+
+        if (tick % GOLDEN_HASH_EVERY == 0)
+            hashes.push_back(hashWorld(world));
     }
-    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Up)) {
-        camAngleX += angleSpeed * dt;
-        if (camAngleX > 89.0f) camAngleX = 89.0f;
+}
+
+// Plik wzorcowy (w repozytorium golden_traces.txt, sprawdzany przez --verify).
+// Format: "<scenariusz> <wariant> <tick> <hasz hex>" w kazdej linii.
+const char* GOLDEN_PATH = "golden_traces.txt";
+
+int recordGolden(const std::string& path)
+{
+    std::ofstream out(path, std::ios::out | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Nie udalo sie otworzyc pliku: " << path << std::endl;
+        return 1;
     }
-    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Down)) {
-        camAngleX -= angleSpeed * dt;
-        if (camAngleX < -10.0f) camAngleX = -10.0f;
+
+    for (const auto& sc : VERIFY_SCENARIOS) {
+        for (const auto& variant : UPDATE_VARIANTS) {
+            std::vector<std::uint64_t> hashes;
+            goldenTrace(sc, variant, hashes);
+            for (std::size_t k = 0; k < hashes.size(); ++k) {
+                out << sc.name << ' ' << variant.name << ' ' << (k + 1) * GOLDEN_HASH_EVERY
+                    << ' ' << std::hex << hashes[k] << std::dec << '\n';
+            }
+        }
     }
-    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Z)) {
-        camDist -= zoomSpeed * dt;
-        if (camDist < 5.0f) camDist = 5.0f;
+    return 0;
+}
+
+int checkGolden(const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Nie udalo sie otworzyc pliku: " << path << std::endl;
+        return 1;
     }
-    if (sf::Keyboard::isKeyPressed(sf::Keyboard::X)) {
-        camDist += zoomSpeed * dt;
-        if (camDist > 80.0f) camDist = 80.0f;
+
+    struct GoldenEntry {
+        std::string scenario;
+        std::string variant;
+        int tick;
+        std::uint64_t hash;
+    };
+    std::vector<GoldenEntry> entries;
+    GoldenEntry e;
+    while (in >> e.scenario >> e.variant >> e.tick >> std::hex >> e.hash >> std::dec)
+        entries.push_back(e);
+
+    int failures = 0;
+    for (const auto& sc : VERIFY_SCENARIOS) {
+        for (const auto& variant : UPDATE_VARIANTS) {
+            std::vector<std::uint64_t> hashes;
+            goldenTrace(sc, variant, hashes);
+
+            std::size_t checked = 0;
+            int mismatch = -1;
+            for (const auto& g : entries) {
+                if (g.scenario != sc.name || g.variant != variant.name) continue;
+
+                std::size_t k = g.tick / GOLDEN_HASH_EVERY - 1;
+                if (k >= hashes.size() || hashes[k] != g.hash) {
+                    mismatch = g.tick;
+                    break;
+                }
+                ++checked;
+            }
+
+            std::cout << "  " << sc.name << " " << variant.name << ": ";
+            if (mismatch >= 0)
+                std::cout << "hash mismatch at tick " << mismatch << "\n";
+            else if (checked == 0)
+                std::cout << "no golden entries\n";
+            else
+                std::cout << checked << " hashes OK\n";
+
+            if (mismatch >= 0 || checked == 0)
+                ++failures;
+        }
     }
+
+    return failures == 0 ? 0 : 1;
 }
 
-void showLegend() {
-    std::cout << "MOVE CAMERA           :   ARROWS\n";
-    std::cout << "ZOOM IN               :   Z\n";
-    std::cout << "ZOOM OUT              :   X\n\n";
+// Blad kwantyzacji PackedAnt: pojedyncze pakowanie oraz dryf na deterministycznej drodze.
+const float VISIBLE_ERROR = 0.01f;
 
-    std::cout << "ADD OBSTACLE          :   O\n";
-    std::cout << "REMOVE OBSTACLE       :   P\n\n";
+float walkError(bool carrying, float x, float z, float dirX, float dirZ, int ticks)
+{
+    World exact;
+    World packed;
+    exact.params.turnSpeed = 0.0f;
+    exact.params.reorientProbPerSec = 0.0f;
+    packed.params = exact.params;
+    packed.packedAnts = true;
 
-    std::cout << "ADD FOOD              :   F\n\n";
+    Ant a;
+    a.x = x;
+    a.z = z;
+    a.dirX = dirX;
+    a.dirZ = dirZ;
+    a.carryingFood = carrying;
+    exact.ants.push_back(a);
+    packed.packed.push_back(packAnt(a));
+
+    float maxError = 0.0f;
+    for (int tick = 0; tick < ticks; ++tick) {
+        updateAntsReference(exact, VERIFY_DT);
+        updateAnts(packed, VERIFY_DT);
+
+        Ant e = exact.ants[0];
+        Ant q = antAt(packed, 0);
+        float err = std::sqrt((e.x - q.x) * (e.x - q.x) + (e.z - q.z) * (e.z - q.z));
+        if (err > maxError) maxError = err;
+    }
+    return maxError;
+}
 
-    std::cout << "ADD ANT               :   A\n";
-    std::cout << "KILL AN ANT           :   K\n";
-    std::cout << "KILL ALL ANTS         :   Q\n";
+bool checkQuantization()
+{
+    const float TWO_PI = 2.0f * 3.14159265f;
+
+    std::mt19937 rng(7);
+    float maxPos = 0.0f;
+    float maxHeading = 0.0f;
+    for (int k = 0; k < 100000; ++k) {
+        Ant a;
+        a.x = (rng() % 100000) / 1000.0f - WORLD_HALF_SIZE;
+        a.z = (rng() % 100000) / 1000.0f - WORLD_HALF_SIZE;
+        float angle = (rng() % 100000) / 100000.0f * TWO_PI;
+        a.dirX = simCos(angle);
+        a.dirZ = simSin(angle);
+
+        Ant b = unpackAnt(packAnt(a));
+        maxPos = std::max(maxPos, std::max(std::fabs(a.x - b.x), std::fabs(a.z - b.z)));
+
+        float dot = a.dirX * b.dirX + a.dirZ * b.dirZ;
+        float cross = a.dirX * b.dirZ - a.dirZ * b.dirX;
+        maxHeading = std::max(maxHeading, std::fabs(std::atan2(cross, dot)));
+    }
 
-}
+    float wander = walkError(false, 5.0f, 0.0f, 0.6f, 0.8f, 600);
+    // 800 tickow to 40 jednostek: mrowka jeszcze nie dochodzi do gniazda, wiec liczy sie tylko dryf
+    float homing = walkError(true, 40.0f, -30.0f, 1.0f, 0.0f, 800);
+
+    std::cout << "packed ants (" << sizeof(PackedAnt) << " vs " << sizeof(Ant) << " bytes):\n"
+        << "  round trip: position " << maxPos << ", heading " << maxHeading << " rad\n"
+        << "  straight walk drift: " << wander << ", homing drift: " << homing
+        << " (limit " << VISIBLE_ERROR << ")\n";
 
-void killAllAnts() {
-    ants.clear();
+    return maxPos < 1.0f / FIXED_ONE && maxHeading < TWO_PI / HEADING_STEPS
+        && wander < VISIBLE_ERROR && homing < VISIBLE_ERROR;
 }
 
-void killAnt() {
-    if (!ants.empty())
-        ants.pop_back();
+// Histogram gestosci musi sie zgadzac z policzeniem mrowek od nowa, takze po dodawaniu i usuwaniu mrowek.
+bool checkDensity()
+{
+    bool ok = true;
+    for (bool packed : { false, true }) {
+        World world;
+        world.packedAnts = packed;
+        world.lazyUpdates = !packed;
+        populateWorld(world, 15, 300, 5);
+
+        for (int tick = 0; tick < 600; ++tick) {
+            if (tick % 100 == 50) {
+                submitCommand(world.commands, WorldCommandType::SpawnAnts, 20);
+                submitCommand(world.commands, WorldCommandType::KillAnts, 10);
+            }
+            topUpFood(world, 10);
+            updateAnts(world, VERIFY_DT);
+        }
+        refreshLazyDensity(world);
+
+        int expected[DENSITY_GRID * DENSITY_GRID] = {};
+        for (const auto& a : world.ants) {
+            Ant m = lazyAntPreview(world, a);
+            expected[densityCellAt(m.x, m.z)]++;
+        }
+        for (const auto& p : world.packed)
+            expected[unpackAnt(p).densityCell]++;
+
+        int wrong = 0;
+        for (int c = 0; c < DENSITY_GRID * DENSITY_GRID; ++c) {
+            if (world.density[c] != expected[c])
+                ++wrong;
+        }
+
+        std::cout << "density histogram (" << (packed ? "packed" : "lazy") << " ants): "
+            << wrong << " cells differ from a recount\n";
+        if (wrong != 0)
+            ok = false;
+    }
+    return ok;
 }
 
-void drawScene() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+int runVerify(const std::string& goldenPath)
+{
+    int failures = 0;
+    if (!checkQuantization())
+        ++failures;
+    if (!checkDensity())
+        ++failures;
+
+    LoadTotals refLoads[UPDATE_VARIANT_COUNT];
+    LoadTotals loads[UPDATE_VARIANT_COUNT];
+    for (const auto& sc : VERIFY_SCENARIOS) {
+        std::cout << sc.name << ":\n";
+        for (int v = 0; v < UPDATE_VARIANT_COUNT; ++v) {
+            if (!compareWithReference(sc, UPDATE_VARIANTS[v], refLoads[v], loads[v]))
+                ++failures;
+        }
+    }
 
-    setCamera();
-    setupLighting();
+    std::cout << "food pickups / deliveries, all scenarios (reference vs variant):\n";
+    for (int v = 0; v < UPDATE_VARIANT_COUNT; ++v) {
+        auto within = [](std::uint64_t ref, std::uint64_t got) {
+            double diff = std::fabs(static_cast<double>(got) - static_cast<double>(ref));
+            return diff <= VERIFY_LOADS_TOLERANCE * static_cast<double>(ref);
+        };
+        bool ok = within(refLoads[v].pickups, loads[v].pickups) && within(refLoads[v].deliveries, loads[v].deliveries);
+
+        std::cout << "  " << UPDATE_VARIANTS[v].name << ": " << refLoads[v].pickups << " vs " << loads[v].pickups
+            << ", " << refLoads[v].deliveries << " vs " << loads[v].deliveries << (ok ? "" : " - FAIL") << "\n";
+        if (!ok)
+            ++failures;
+    }
 
-    drawFood();
-    drawGround();
-    drawAnthill();
-    drawAnts();
-    drawObstacles();
+    std::cout << "golden traces (" << goldenPath << "):\n";
+    if (checkGolden(goldenPath) != 0)
+        ++failures;
+
+    return failures == 0 ? 0 : 1;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && std::string(argv[1]) == "--batch")
+        return runBatch(argc - 2, argv + 2);
+    if (argc > 1 && std::string(argv[1]) == "--verify")
+        return runVerify(argc > 2 ? argv[2] : GOLDEN_PATH);
+    if (argc > 2 && std::string(argv[1]) == "--golden-record")
+        return recordGolden(argv[2]);
+    if (argc > 2 && std::string(argv[1]) == "--golden-check")
+        return checkGolden(argv[2]);
+    if (argc > 1 && std::string(argv[1]) == "--terrain-convert")
+        return convertHeightmap(argc - 2, argv + 2);
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--terrain" && i + 1 < argc) {
+            openTerrain(g_terrain, argv[++i]);
+            continue;
+        }
+
+        std::vector<float> values;
+        int param = parseParamArg(argv[i], values);
+        if (param == PARAM_INVALID)
+            return 1;
+        if (param >= 0 && !values.empty())
+            g_world.params.*(SWEEP_PARAMS[param].field) = values[0];
+    }
+
+    // druga instancja w tym samym katalogu przejelaby gniazdo sterujace i nadpisywala pamiec wspoldzielona
+    if (controlSocketInUse()) {
+        std::cerr << "Symulacja juz dziala w tym katalogu (odpowiada " << CONTROL_SOCKET_PATH << ")" << std::endl;
+        return 1;
+    }
+
     sf::ContextSettings settings;
     settings.depthBits = 24;
     settings.stencilBits = 8;
@@ -837,6 +4578,16 @@ int main()
     sf::Clock clock;
     showLegend();
 
+    MetricsReporter metrics;
+    openMetrics(metrics, "metrics.jsonl");
+
+    SimControl control;
+    TimeWarp warp;
+    SharedExport sharedExport;
+    openSharedExport(sharedExport);
+    ControlChannel controlChannel;
+    openControlChannel(controlChannel);
+
     bool running = true;
     while (running && window.isOpen()) {
         sf::Event event;
@@ -849,36 +4600,76 @@ int main()
                 resizeGL(event.size.width, event.size.height);
             }
             else if (sf::Keyboard::isKeyPressed(sf::Keyboard::A)) {
-                addRandomAnt();
+                submitCommand(g_world.commands, WorldCommandType::SpawnAnts);
             }
             else if (sf::Keyboard::isKeyPressed(sf::Keyboard::K)) {
-                killAnt();
+                submitCommand(g_world.commands, WorldCommandType::KillAnts);
             }
             else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Q)) {
-                killAllAnts();
+                submitCommand(g_world.commands, WorldCommandType::KillAllAnts);
             }
             else if (event.key.code == sf::Keyboard::O) {
-                addRandomObstacle();
+                submitCommand(g_world.commands, WorldCommandType::AddObstacle);
             }
-            else if (event.key.code == sf::Keyboard::P && !obstacles.empty()) {
-                obstacles.pop_back();
+            else if (event.key.code == sf::Keyboard::P) {
+                submitCommand(g_world.commands, WorldCommandType::RemoveObstacle);
             }
             else if (event.key.code == sf::Keyboard::F) {
-                addRandomFood();
+                submitCommand(g_world.commands, WorldCommandType::AddFood);
+            }
+            else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::H) {
+                g_showDensity = !g_showDensity;
+            }
+            else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::L) {
+                g_world.lazyUpdates = !g_world.lazyUpdates;
+            }
+            else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::G) {
+                // uspione mrowki sa odtwarzane z tym samym sposobem wyboru kierunku, z jakim zasnely
+                wakeAllLazyAnts(g_world);
+                g_world.useFlowField = !g_world.useFlowField;
+            }
+            else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::T) {
+                cycleWarp(warp);
+                window.setTitle(metrics.summary + "  speed: " + warpLabel(warp));
             }
         }
 
         float dt = clock.restart().asSeconds();
 
         updateCameraFromKeyboard(dt);
-        updateAnts(dt);
 
-        drawScene();
+        pollControlChannel(controlChannel, g_world, control);
+        if (!control.paused) {
+            advanceSimulation(g_world, warp, dt);
+        }
+        else if (control.pendingSteps == 0) {
+            // w pauzie zmiany tez maja byc widoczne od razu
+            applyWorldCommands(g_world);
+        }
+        auto stepDeadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(WARP_FRAME_BUDGET);
+        while (control.pendingSteps > 0) {
+            updateAnts(g_world, CONTROL_STEP_DT);
+            --control.pendingSteps;
+            if (std::chrono::steady_clock::now() >= stepDeadline)
+                break;
+        }
+
+        publishSharedState(sharedExport, g_world);
+
+        if (updateMetrics(g_world, metrics, dt)) {
+            window.setTitle(metrics.summary + "  speed: " + warpLabel(warp));
+        }
+
+        drawScene(g_world);
 
         window.display();
 
     }
 
+    closeControlChannel(controlChannel);
+    closeSharedExport(sharedExport);
+    closeTerrain(g_terrain);
+
     if (g_quadric) {
         gluDeleteQuadric(g_quadric);
     }
@@ -0,0 +1,270 @@
+#pragma once
+
+// Uklad pamieci wspoldzielonej, w ktorej symulacja publikuje swoj stan, oraz
+// drobne funkcje platformowe wspolne dla symulacji i programu StateReader.
+//
+// Segment "anthill_state" zawiera SharedHeader i dwa bufory SharedBuffer (SoA).
+// Symulacja zapisuje zawsze do bufora, ktory nie jest wskazany przez header.front:
+//   1) buffer.seq += 1 (nieparzyste = trwa zapis),
+//   2) zapis tablic,
+//   3) buffer.seq += 1 (parzyste = spojne dane),
+//   4) header.front = numer tego bufora.
+// Czytelnik bierze front, odczytuje seq (musi byc parzyste), kopiuje dane i sprawdza,
+// czy seq sie nie zmienilo; jesli sie zmienilo, probuje jeszcze raz.
+//
+// Wszystkie pola maja stale rozmiary, wiec czytelnik w innym jezyku (np. Python + mmap/struct)
+// moze korzystac z tych samych przesuniec. Kanal sterujacy to gniazdo Unix "anthill.sock"
+// przyjmujace polecenia tekstowe zakonczone '\n'.
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#include <windows.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+const char* const SHARED_STATE_NAME = "Local\\anthill_state";
+#else
+const char* const SHARED_STATE_NAME = "/anthill_state";
+#endif
+const char* const CONTROL_SOCKET_PATH = "anthill.sock";
+
+const std::uint32_t SHARED_STATE_MAGIC = 0x31544e41; // "ANT1"
+const std::uint32_t SHARED_STATE_VERSION = 1;
+
+const std::uint32_t SHARED_MAX_ANTS = 2000;
+const std::uint32_t SHARED_MAX_FOODS = 20;
+const std::uint32_t SHARED_MAX_OBSTACLES = 35;
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "seqlock needs lock-free 32-bit atomics");
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "header needs lock-free 64-bit atomics");
+
+struct SharedBuffer {
+    std::atomic<std::uint32_t> seq;
+    std::uint32_t antCount;
+    std::uint32_t foodCount;
+    std::uint32_t obstacleCount;
+    std::uint64_t tick;
+    double simTime;
+
+    float antX[SHARED_MAX_ANTS];
+    float antY[SHARED_MAX_ANTS];
+    float antZ[SHARED_MAX_ANTS];
+    float antDirX[SHARED_MAX_ANTS];
+    float antDirZ[SHARED_MAX_ANTS];
+    std::uint8_t antCarrying[SHARED_MAX_ANTS];
+
+    float foodX[SHARED_MAX_FOODS];
+    float foodY[SHARED_MAX_FOODS];
+    float foodZ[SHARED_MAX_FOODS];
+    std::int32_t foodAmount[SHARED_MAX_FOODS];
+
+    float obstacleX[SHARED_MAX_OBSTACLES];
+    float obstacleY[SHARED_MAX_OBSTACLES];
+    float obstacleZ[SHARED_MAX_OBSTACLES];
+    float obstacleSize[SHARED_MAX_OBSTACLES];
+};
+
+struct SharedHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t maxAnts;
+    std::uint32_t maxFoods;
+    std::uint32_t maxObstacles;
+    std::atomic<std::uint32_t> front;
+    std::atomic<std::uint64_t> published;
+};
+
+struct SharedState {
+    SharedHeader header;
+    SharedBuffer buffers[2];
+};
+
+struct SharedMapping {
+    SharedState* state = nullptr;
+    bool owner = false;
+#ifdef _WIN32
+    HANDLE handle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Tworzy (owner = true) albo otwiera istniejacy segment.
+inline bool mapSharedState(SharedMapping& m, bool create)
+{
+    const std::size_t size = sizeof(SharedState);
+    m.owner = create;
+
+#ifdef _WIN32
+    if (create) {
+        m.handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+            0, static_cast<DWORD>(size), SHARED_STATE_NAME);
+    }
+    else {
+        m.handle = OpenFileMappingA(FILE_MAP_READ, FALSE, SHARED_STATE_NAME);
+    }
+    if (!m.handle)
+        return false;
+
+    void* view = MapViewOfFile(m.handle, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size);
+    if (!view) {
+        CloseHandle(m.handle);
+        m.handle = nullptr;
+        return false;
+    }
+#else
+    m.fd = create ? shm_open(SHARED_STATE_NAME, O_CREAT | O_RDWR, 0644)
+                  : shm_open(SHARED_STATE_NAME, O_RDONLY, 0);
+    if (m.fd < 0)
+        return false;
+
+    if (create && ftruncate(m.fd, static_cast<off_t>(size)) != 0) {
+        close(m.fd);
+        m.fd = -1;
+        return false;
+    }
+
+    void* view = mmap(nullptr, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m.fd, 0);
+    if (view == MAP_FAILED) {
+        close(m.fd);
+        m.fd = -1;
+        return false;
+    }
+#endif
+
+    m.state = static_cast<SharedState*>(view);
+    return true;
+}
+
+inline void unmapSharedState(SharedMapping& m)
+{
+    if (!m.state)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(m.state);
+    CloseHandle(m.handle);
+    m.handle = nullptr;
+#else
+    munmap(m.state, sizeof(SharedState));
+    close(m.fd);
+    m.fd = -1;
+    if (m.owner)
+        shm_unlink(SHARED_STATE_NAME);
+#endif
+
+    m.state = nullptr;
+}
+
+// Spojna kopia najnowszego bufora; false, jesli przez wiele prob pisarz ciagle nadpisywal dane.
+inline bool readSharedSnapshot(const SharedState& state, SharedBuffer& out)
+{
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        std::uint32_t front = state.header.front.load(std::memory_order_acquire);
+        const SharedBuffer& buf = state.buffers[front & 1];
+
+        std::uint32_t before = buf.seq.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+
+        std::memcpy(static_cast<void*>(&out), &buf, sizeof(SharedBuffer));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (buf.seq.load(std::memory_order_relaxed) == before)
+            return true;
+    }
+    return false;
+}
+
+// ----------------- GNIAZDA -----------------
+
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+const SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+
+inline bool initSockets()
+{
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+}
+
+inline void closeSocket(SocketHandle s)
+{
+    closesocket(s);
+}
+
+inline bool setNonBlocking(SocketHandle s)
+{
+    u_long mode = 1;
+    return ioctlsocket(s, FIONBIO, &mode) == 0;
+}
+
+inline bool socketWouldBlock()
+{
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+inline int sendText(SocketHandle s, const std::string& text)
+{
+    return send(s, text.data(), static_cast<int>(text.size()), 0);
+}
+#else
+typedef int SocketHandle;
+const SocketHandle INVALID_SOCKET_HANDLE = -1;
+
+inline bool initSockets()
+{
+    return true;
+}
+
+inline void closeSocket(SocketHandle s)
+{
+    close(s);
+}
+
+inline bool setNonBlocking(SocketHandle s)
+{
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+inline bool socketWouldBlock()
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+// Zapis do gniazda zamknietego po drugiej stronie nie moze zabic procesu sygnalem SIGPIPE.
+inline int sendText(SocketHandle s, const std::string& text)
+{
+#ifdef MSG_NOSIGNAL
+    return static_cast<int>(send(s, text.data(), text.size(), MSG_NOSIGNAL));
+#else
+    return static_cast<int>(send(s, text.data(), text.size(), 0));
+#endif
+}
+#endif
+
+inline sockaddr_un controlSocketAddress()
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, CONTROL_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    return addr;
+}
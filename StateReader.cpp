@@ -0,0 +1,108 @@
+// Przykladowy czytelnik stanu symulacji z pamieci wspoldzielonej (patrz SharedState.h).
+//
+//   StateReader                 - co sekunde wypisuje podsumowanie najnowszego stanu
+//   StateReader --once          - jedno podsumowanie i pierwsze mrowki, potem koniec
+//   StateReader --cmd spawn 10  - wysyla polecenie kanalem sterujacym i wypisuje odpowiedz
+//
+// Kompilacja (Linux): g++ -std=c++17 -O2 StateReader.cpp -o StateReader -lrt
+
+#include "SharedState.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+int sendCommand(const std::string& command)
+{
+    if (!initSockets())
+        return 1;
+
+    SocketHandle s = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = controlSocketAddress();
+    if (s == INVALID_SOCKET_HANDLE || connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "Nie udalo sie polaczyc z " << CONTROL_SOCKET_PATH << std::endl;
+        return 1;
+    }
+
+    std::string line = command + "\n";
+    sendText(s, line);
+
+    std::string reply;
+    char buffer[256];
+    while (reply.find('\n') == std::string::npos) {
+        int got = static_cast<int>(recv(s, buffer, sizeof(buffer), 0));
+        if (got <= 0) break;
+        reply.append(buffer, got);
+    }
+    closeSocket(s);
+
+    std::cout << reply;
+    return reply.compare(0, 2, "ok") == 0 ? 0 : 1;
+}
+
+void printSummary(const SharedBuffer& buf, std::uint64_t published)
+{
+    std::uint32_t carrying = 0;
+    for (std::uint32_t i = 0; i < buf.antCount; ++i)
+        carrying += buf.antCarrying[i];
+
+    std::int64_t foodLeft = 0;
+    for (std::uint32_t i = 0; i < buf.foodCount; ++i)
+        foodLeft += buf.foodAmount[i];
+
+    std::cout << "frame " << buf.tick << " (published " << published << ")"
+        << "  time " << buf.simTime
+        << "  ants " << buf.antCount << " (carrying " << carrying << ")"
+        << "  food " << foodLeft << " in " << buf.foodCount << " sources"
+        << "  obstacles " << buf.obstacleCount << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+    std::string mode = argc > 1 ? argv[1] : "";
+
+    if (mode == "--cmd") {
+        std::string command;
+        for (int i = 2; i < argc; ++i) {
+            if (i > 2) command += ' ';
+            command += argv[i];
+        }
+        return sendCommand(command);
+    }
+
+    SharedMapping mapping;
+    if (!mapSharedState(mapping, false)) {
+        std::cerr << "Brak pamieci wspoldzielonej " << SHARED_STATE_NAME << " - czy symulacja dziala?" << std::endl;
+        return 1;
+    }
+
+    const SharedState& state = *mapping.state;
+    if (state.header.magic != SHARED_STATE_MAGIC || state.header.version != SHARED_STATE_VERSION) {
+        std::cerr << "Nieznany format pamieci wspoldzielonej" << std::endl;
+        unmapSharedState(mapping);
+        return 1;
+    }
+
+    std::unique_ptr<SharedBuffer> snapshot(new SharedBuffer);
+
+    for (;;) {
+        if (readSharedSnapshot(state, *snapshot)) {
+            printSummary(*snapshot, state.header.published.load(std::memory_order_acquire));
+
+            if (mode == "--once") {
+                for (std::uint32_t i = 0; i < snapshot->antCount && i < 5; ++i) {
+                    std::cout << "  ant " << i << ": x=" << snapshot->antX[i] << " y=" << snapshot->antY[i]
+                        << " z=" << snapshot->antZ[i] << " carrying=" << int(snapshot->antCarrying[i]) << "\n";
+                }
+                break;
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    unmapSharedState(mapping);
+    return 0;
+}